@@ -27,12 +27,24 @@
 
 #include "conf.h"
 #include "privs.h"
+#include "mod_fault.h"
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+# define MAP_ANONYMOUS	MAP_ANON
+#endif
 
 #define MOD_FAULT_VERSION		"mod_fault/0.0"
 
-/* Make sure the version of proftpd is as necessary. */
-#if PROFTPD_VERSION_NUMBER < 0x0001030001
-# error "ProFTPD 1.3.0rc1 or later required"
+/* Make sure the version of proftpd is as necessary: 1.3.6rc1 is the first
+ * to provide all of the APIs used here, e.g. pr_alloc_netio2(),
+ * pr_cmd_set_errno(), and pr_config_get_server_xfer_bufsz().
+ */
+#if PROFTPD_VERSION_NUMBER < 0x0001030601
+# error "ProFTPD 1.3.6rc1 or later required"
 #endif
 
 module fault_module;
@@ -40,7 +52,431 @@ module fault_module;
 static int fault_engine = FALSE;
 
 static pool *fault_pool = NULL;
-static pr_table_t *fault_fsio_errtab = NULL;
+
+/* Each configured operation has a rule, describing the errors and/or delays
+ * to inject.  Rules follow a two-state (good/bad) Gilbert-Elliott model, so
+ * that faults can come in bursts; without FaultBurst, a rule stays in the
+ * good state.
+ */
+#define FAULT_STATE_GOOD	0
+#define FAULT_STATE_BAD		1
+
+/* A bandwidth cap is a throughput curve: each segment's rate (in bytes per
+ * second) applies until the handle has transferred that segment's number of
+ * bytes.  The last segment's rate applies thereafter.
+ */
+struct fault_bandwidth_segment {
+  off_t rate;
+  off_t until;
+};
+
+struct fault_bandwidth {
+  unsigned int nsegments;
+  struct fault_bandwidth_segment *segments;
+};
+
+/* The errno name and text are resolved once, when the rule is configured,
+ * rather than for each injected fault.
+ */
+struct fault_rule_error {
+  int xerrno;
+  const char *name;
+  const char *text;
+  unsigned int weight;
+};
+
+#define FAULT_SCOPE_SESSION	0
+#define FAULT_SCOPE_HANDLE	1
+#define FAULT_SCOPE_PATH	2
+
+struct fault_rule {
+  const char *oper;
+
+  /* The configuration context, e.g. "<Directory /srv/ftp>"; NULL for the
+   * server itself.
+   */
+  const char *context;
+
+  /* The errnos to inject (if any), weighted, and the probability of doing
+   * so in each state.
+   */
+  unsigned int nerrors;
+  struct fault_rule_error *errors;
+  unsigned int total_weight;
+  double error_prob[2];
+
+  /* Transient faults: inject at most this many errors (per session, handle,
+   * or path), then let calls succeed.  Zero means no limit.
+   */
+  unsigned int max_faults;
+  int fault_scope;
+  pr_table_t *fault_counts;
+
+  /* Delay, in microseconds, in each state. */
+  unsigned long delay_usecs[2];
+
+  /* State transition probabilities, evaluated per call. */
+  double good_to_bad, bad_to_good;
+
+  /* Bandwidth cap, for read/write operations. */
+  struct fault_bandwidth *bandwidth;
+
+  /* Per-session state and statistics. */
+  int state;
+  unsigned int faults;
+  unsigned long calls, bad_periods, bad_calls;
+};
+
+/* Per-session PRNG state. */
+static uint64_t fault_prng_state = 0;
+
+/* Rules are configured per context (server, <Global>, <Anonymous>,
+ * <Directory>), each context having its own table of rules, keyed by
+ * operation.  For each session, these are compiled into the table of rules
+ * in effect for the session, plus a trie of the <Directory> paths with rules,
+ * each node having the merged table in effect at and below that path.  Thus
+ * finding the rule for an operation costs a walk of the path, regardless of
+ * how many contexts are configured.
+ */
+struct fault_path_node {
+  /* Keyed by path component. */
+  pr_table_t *children;
+
+  /* Rules/FaultEngine configured for this directory, if any. */
+  pr_table_t *rules;
+  int engine;
+
+  /* The rules in effect here; NULL if none. */
+  pr_table_t *compiled;
+};
+
+static pr_table_t *fault_sess_ruletab = NULL;
+static struct fault_path_node *fault_sess_dirs = NULL;
+
+/* All of the rules, from all contexts, which apply to this session. */
+static array_header *fault_sess_rules = NULL;
+
+/* Set if any rule counts its transient faults per handle. */
+static int fault_have_handle_scope = FALSE;
+
+/* Set if any rule caps the bandwidth of reads/writes. */
+static int fault_have_bandwidth = FALSE;
+
+/* FaultLog: which of the injected faults are logged. */
+#define FAULT_LOG_ALL		0
+#define FAULT_LOG_SAMPLE	1
+#define FAULT_LOG_RATE		2
+
+struct fault_log {
+  int mode;
+
+  /* For sampling, log 1 in this many faults; for rate limiting, log at most
+   * this many faults per second.
+   */
+  unsigned long limit;
+
+  unsigned long seen, logged, suppressed;
+
+  /* Faults suppressed since the last one logged. */
+  unsigned long pending;
+
+  time_t window_start;
+  unsigned long window_count;
+};
+
+static struct fault_log fault_log;
+
+/* Per-session state for the open file handles seen by our FSIO callbacks,
+ * for those emulations which need to know the file identity and current
+ * offset.
+ */
+struct fault_handle {
+  struct fault_handle *next;
+
+  pr_fh_t *fh;
+  int fd;
+
+  dev_t dev;
+  ino_t ino;
+  off_t pos;
+
+  /* The end of the previous read/seek, i.e. where the "disk head" is. */
+  off_t head;
+
+  /* Bytes written, but not yet "flushed" to storage. */
+  off_t dirty;
+
+  /* Bytes read/written, and when the first read/write happened, for
+   * bandwidth shaping.
+   */
+  struct fault_bandwidth *bandwidth[2];
+  off_t xfer_bytes[2];
+  uint64_t xfer_start_usecs[2];
+};
+
+#define FAULT_XFER_READ		0
+#define FAULT_XFER_WRITE	1
+
+static int fault_track_handles = FALSE;
+static struct fault_handle *fault_handles = NULL;
+static struct fault_handle *fault_free_handles = NULL;
+
+/* Downloads sent using sendfile(2) never pass through our read callbacks,
+ * and once started cannot be interrupted.  Thus for RETR any injected error
+ * is decided before the transfer starts ("checked"), and we note whether any
+ * reads happened; if not, the bandwidth costs are applied when the file is
+ * closed.
+ */
+struct fault_retr {
+  int active;
+  int checked;
+  unsigned long reads;
+  unsigned long delay_usecs;
+  uint64_t start_usecs;
+};
+
+static struct fault_retr fault_retr;
+
+/* The paths of the open directory handles, keyed by handle, so that the
+ * readdir and closedir operations, which only see the handle, can find the
+ * rules for the directory.  The pool is destroyed whenever the last open
+ * handle is closed.
+ */
+static pool *fault_dir_pool = NULL;
+static pr_table_t *fault_dir_paths = NULL;
+
+static int fault_have_command_delays = FALSE;
+
+#define FAULT_RETR_VIA_READ	0
+#define FAULT_RETR_VIA_SENDFILE	1
+
+static unsigned long fault_retr_count[2];
+static off_t fault_retr_bytes[2];
+
+/* I/O profiling, for FaultProfile: power-of-two histograms of the read and
+ * write sizes reaching the filesystem, per data command and per session.
+ * Bucket N counts sizes in [2^N, 2^(N+1)); the last bucket also counts any
+ * larger sizes.
+ */
+#define FAULT_PROFILE_NBUCKETS	25
+#define FAULT_PROFILE_ALIGN	4096
+
+struct fault_io_profile {
+  unsigned long calls;
+  uint64_t bytes;
+  unsigned long sizes[FAULT_PROFILE_NBUCKETS];
+  unsigned long unaligned_offsets, unaligned_sizes;
+};
+
+static int fault_profile = FALSE;
+static struct fault_io_profile fault_cmd_profile[2];
+static struct fault_io_profile fault_sess_profile[2];
+
+/* Time spent per command, FTP or SFTP, and how much of that was spent in
+ * each filesystem operation, for FaultProfile.
+ */
+#define FAULT_FSIO_NOPS \
+  ((sizeof(fault_fsio_operations) / sizeof(char *)) - 1)
+
+struct fault_cmd_time {
+  const char *name;
+  unsigned long count;
+  uint64_t total_usecs;
+  uint64_t *fsio_usecs;
+};
+
+/* The current data transfer, and the time spent in the filesystem and the
+ * data connection, for finding whether it is storage- or network-bound.  The
+ * network time is only known if our NetIO saw the transfer, i.e. not if
+ * another module handles the data connection, or sendfile(2) was used.
+ */
+static struct {
+  int active;
+  int netio_seen;
+  uint64_t start_usecs;
+  uint64_t fsio_usecs, netio_usecs;
+} fault_xfer;
+
+/* The current command's filesystem time, injected faults, and delays, for
+ * the mod_fault.fs-ms, mod_fault.faults, and mod_fault.delay-ms notes.
+ */
+static struct {
+  uint64_t fsio_usecs;
+  unsigned long faults;
+  uint64_t delay_usecs;
+} fault_cmd_stats;
+
+static array_header *fault_cmd_times = NULL;
+static struct fault_cmd_time *fault_cmd_time = NULL;
+static uint64_t fault_cmd_start_usecs = 0;
+
+/* The filesystem operation in progress, and when it started.  Operations
+ * are timed when profiling, or when logging slow operations.
+ */
+static struct {
+  const char *oper;
+  const char *path;
+  size_t size;
+  off_t offset;
+  uint64_t start_usecs;
+} fault_op;
+
+static int fault_time_ops = FALSE;
+
+/* Slow operation logging, for FaultSlowOpThreshold: the most recent
+ * operations are kept in a ring buffer, which is dumped whenever an
+ * operation takes longer than the threshold, to show what led up to it.
+ *
+ * Operations under the threshold cost only their timestamps, and storing
+ * pointers to constant or session-lifetime strings in the ring.  The path may
+ * be in a caller's buffer that is gone by the time a later operation is
+ * slow, and so is only logged for the slow operation itself.
+ */
+#define FAULT_SLOW_OP_DEFAULT_COUNT	10
+
+struct fault_op_record {
+  const char *oper;
+  const char *path;
+  const char *cmd;
+  size_t size;
+  off_t offset;
+  uint64_t start_usecs;
+  uint64_t elapsed_usecs;
+};
+
+static unsigned long fault_slow_op_usecs = 0;
+static struct fault_op_record *fault_op_ring = NULL;
+static unsigned int fault_op_ringsz = 0;
+static unsigned long fault_op_count = 0;
+
+/* The current command's name, interned for the session, for the ring. */
+static pr_table_t *fault_op_cmds = NULL;
+static const char *fault_op_cmd = "none";
+
+/* A spinlock for the state shared by all sessions.  The owner is noted, so
+ * that the lock can be reclaimed should its owner die whilst holding it.
+ */
+struct fault_shm_lock {
+  volatile int locked;
+  volatile pid_t owner;
+};
+
+/* Page cache emulation: a bounded LRU of (file, extent) pairs.  Reads of
+ * extents not in the cache are "cold", and are delayed accordingly.
+ *
+ * Like the kernel's page cache, the emulated cache is shared by all sessions,
+ * so it lives in shared memory, mapped in the daemon process when the
+ * configuration is parsed and inherited by the session processes; thus the
+ * pointers within it are valid in every session.
+ */
+#define FAULT_PAGE_CACHE_DEFAULT_EXTENTSZ	(128 * 1024)
+
+struct fault_page {
+  struct fault_page *hash_next;
+  struct fault_page *lru_prev, *lru_next;
+
+  dev_t dev;
+  ino_t ino;
+  off_t extent;
+};
+
+struct fault_page_cache {
+  struct fault_shm_lock lock;
+  size_t mapsz;
+
+  struct fault_page **buckets;
+  unsigned long nbuckets;
+
+  /* The pages, used in order until the cache is full. */
+  struct fault_page *pages;
+
+  /* Most recently used pages are at the head. */
+  struct fault_page *lru_head, *lru_tail;
+  unsigned long npages, max_pages;
+
+  off_t extentsz;
+  unsigned long cold_usecs;
+
+  /* Totals across all sessions. */
+  unsigned long hits, misses;
+};
+
+static struct fault_page_cache *fault_page_cache = NULL;
+
+/* This session's hits and misses. */
+static unsigned long fault_page_cache_hits = 0;
+static unsigned long fault_page_cache_misses = 0;
+
+/* HDD seek cost emulation: accesses which are not sequential to the previous
+ * access on the same handle pay a seek cost proportional to the distance,
+ * plus rotational latency.
+ */
+#define FAULT_SEEK_GB		((off_t) 1024 * 1024 * 1024)
+
+struct fault_seek_model {
+  unsigned long usecs_per_gb;
+  unsigned long rotational_usecs;
+  unsigned long max_seek_usecs;
+
+  unsigned long sequential, seeks;
+  uint64_t seek_usecs;
+};
+
+static struct fault_seek_model *fault_seek_model = NULL;
+
+/* Write-back emulation: writes are cheap, accumulating dirty bytes on the
+ * handle; the cost of flushing those bytes, at the configured bandwidth, is
+ * paid at close(2) or fsync(2) time.
+ */
+struct fault_writeback {
+  off_t flush_bps;
+
+  /* Once a handle has this many dirty bytes, writes are throttled to the
+   * flush bandwidth.  Zero means unlimited.
+   */
+  off_t max_dirty;
+
+  unsigned long flushes;
+  uint64_t flushed_bytes, flush_usecs, max_flush_usecs;
+};
+
+static struct fault_writeback *fault_writeback = NULL;
+
+/* Volume emulation: a cloud block storage volume has a baseline IOPS rate,
+ * plus a bucket of burst credits.  Each operation on the volume consumes a
+ * credit; credits refill at the baseline rate, up to the bucket size.  Once
+ * the credits are gone, operations are delayed to the baseline rate.
+ *
+ * The bucket is shared by all sessions, so it lives in shared memory,
+ * mapped in the daemon process when the configuration is parsed and
+ * inherited by the session processes.
+ */
+struct fault_volume_bucket {
+  struct fault_shm_lock lock;
+
+  /* May go negative, when operations are queued waiting for credits. */
+  double credits;
+  uint64_t refill_usecs;
+
+  /* Totals across all sessions. */
+  unsigned long ops, throttled_ops;
+};
+
+struct fault_volume {
+  const char *path;
+  size_t pathlen;
+
+  unsigned long baseline_iops;
+  double burst_credits;
+
+  struct fault_volume_bucket *bucket;
+
+  /* This session's operations on this volume. */
+  unsigned long ops, throttled_ops;
+  uint64_t throttle_usecs;
+};
+
+static array_header *fault_volumes = NULL;
 
 struct fault_error {
   const char *error_name;
@@ -54,6 +490,12 @@ static struct fault_error fault_errors[] = {
 #if defined(EBUSY)
   { "EBUSY",	EBUSY },
 #endif /* EBUSY */
+#if defined(ECONNABORTED)
+  { "ECONNABORTED", ECONNABORTED },
+#endif /* ECONNABORTED */
+#if defined(ECONNRESET)
+  { "ECONNRESET", ECONNRESET },
+#endif /* ECONNRESET */
 #if defined(EDQUOT)
   { "EDQUOT",	EDQUOT },
 #endif /* EDQUOT */
@@ -63,6 +505,9 @@ static struct fault_error fault_errors[] = {
 #endif /* EFBIG */
   { "EIO",	EIO },
   { "EINTR",	EINTR },
+#if defined(EHOSTUNREACH)
+  { "EHOSTUNREACH", EHOSTUNREACH },
+#endif /* EHOSTUNREACH */
 #if defined(EMFILE)
   { "EMFILE",	EMFILE },
 #endif /* EMFILE */
@@ -78,6 +523,15 @@ static struct fault_error fault_errors[] = {
   { "ENOENT",	ENOENT },
   { "ENOMEM",	ENOMEM },
   { "ENOSPC",	ENOSPC },
+#if defined(ENETDOWN)
+  { "ENETDOWN",	ENETDOWN },
+#endif /* ENETDOWN */
+#if defined(ENETRESET)
+  { "ENETRESET", ENETRESET },
+#endif /* ENETRESET */
+#if defined(ENETUNREACH)
+  { "ENETUNREACH", ENETUNREACH },
+#endif /* ENETUNREACH */
 #if defined(ENOTEMPTY)
   { "ENOTEMPTY", ENOTEMPTY },
 #endif /* ENOTEMPTY */
@@ -88,12 +542,16 @@ static struct fault_error fault_errors[] = {
   { "EOPNOTSUPP", EOPNOTSUPP },
 #endif /* EOPNOTSUPP */
   { "EPERM",	EPERM },
+  { "EPIPE",	EPIPE },
 #if defined(EROFS)
   { "EROFS",	EROFS },
 #endif /* EROFS */
 #if defined(ESTALE)
   { "ESTALE",	ESTALE },
 #endif /* ESTALE */
+#if defined(ETIMEDOUT)
+  { "ETIMEDOUT", ETIMEDOUT },
+#endif /* ETIMEDOUT */
 #if defined(ETXTBUSY)
   { "ETXTBUSY",	ETXTBUSY },
 #endif /* ETXTBUSY */
@@ -119,6 +577,7 @@ static const char *fault_fsio_operations[] = {
   "closedir",
   "fchmod",
   "fchown",
+  "fsync",
   "lchown",
   "lseek",
   "mkdir",
@@ -128,6 +587,7 @@ static const char *fault_fsio_operations[] = {
   "readlink",
   "rename",
   "rmdir",
+  "sendfile",
   "write",
   "unlink",
   "utimes",
@@ -136,6 +596,227 @@ static const char *fault_fsio_operations[] = {
 
 static const char *trace_channel = "fault";
 
+/* Delays for FTP (or SFTP) commands, optionally only for a given user or
+ * class.
+ */
+struct fault_command_delay {
+  array_header *commands;
+  unsigned long delay_usecs;
+  const char *user;
+  const char *class_name;
+
+  /* Per-session counts, for the end-of-session summary. */
+  unsigned long delayed;
+  unsigned long delayed_usecs;
+};
+
+/* Delays for authentication lookups, emulating slow identity backends such
+ * as LDAP or SQL.  Indexed as fault_auth_operations.
+ */
+static const char *fault_auth_operations[] = {
+  "auth",
+  "check",
+  "getgrgid",
+  "getgrnam",
+  "getgroups",
+  "getpwnam",
+  "getpwuid",
+  "gid2name",
+  "name2gid",
+  "name2uid",
+  "uid2name",
+  NULL
+};
+
+#define FAULT_AUTH_NOPS		11
+
+static unsigned long fault_auth_delay_usecs[FAULT_AUTH_NOPS];
+static unsigned long fault_auth_delayed[FAULT_AUTH_NOPS];
+
+/* Errors and stalls for the control/data connections, injected once a
+ * stream has transferred some bytes, and/or been open for some time.
+ */
+struct fault_netio_rule {
+  /* The errors, probability, stall (as the delay), and counts. */
+  struct fault_rule rule;
+
+  int strm_type;
+  off_t after_bytes;
+  unsigned long after_usecs;
+
+  /* Whether this rule has stalled the current stream. */
+  int stalled;
+
+  /* Each fault starts a burst of this many consecutive faults. */
+  unsigned int burst;
+  unsigned int burst_left;
+};
+
+struct fault_netio_stream {
+  off_t bytes;
+  uint64_t start_usecs;
+
+  /* The reads/writes of the current stream, how many of them were capped
+   * by fragmentation, and how many failed with injected EAGAIN/EINTR; each
+   * of the latter costs the caller an extra call.
+   */
+  unsigned long calls, fragments, retries;
+  struct rusage start_rusage;
+
+  /* Totals, across all of the session's streams of this type. */
+  unsigned long total_calls, total_fragments, total_retries;
+  uint64_t total_cpu_usecs;
+};
+
+#define FAULT_NETIO_CTRL	0
+#define FAULT_NETIO_DATA	1
+
+static array_header *fault_netio_rules = NULL;
+static struct fault_netio_stream fault_netio_streams[2];
+
+#define FAULT_FRAGMENT_READ	0x01
+#define FAULT_FRAGMENT_WRITE	0x02
+
+/* Maximum read/write sizes, for fragmentation; zero for no limit.  Indexed
+ * by stream, then FAULT_XFER_READ/WRITE.
+ */
+static size_t fault_netio_max_io[2][2];
+static pr_netio_t *fault_netio = NULL;
+
+/* The core's callbacks, which do the actual I/O. */
+static pr_netio_stream_t *(*fault_netio_open_cb)(pr_netio_stream_t *, int,
+  int) = NULL;
+static int (*fault_netio_close_cb)(pr_netio_stream_t *) = NULL;
+static int (*fault_netio_read_cb)(pr_netio_stream_t *, char *, size_t) = NULL;
+static int (*fault_netio_write_cb)(pr_netio_stream_t *, char *, size_t) = NULL;
+
+/* FaultEngine sampling keys */
+#define FAULT_SAMPLE_BY_ADDRESS		1
+#define FAULT_SAMPLE_BY_SESSION		2
+
+/* Stalls, i.e. delays of at least FAULT_STALL_USECS, including "forever"
+ * delays.  If the session ends while stalled, e.g. due to TimeoutStalled,
+ * we log how long that took.
+ */
+static struct {
+  uint64_t start_usecs;
+  uint64_t total_usecs;
+  unsigned long stalls;
+} fault_stall;
+
+#define FAULT_STALL_USECS		1000000UL
+#define FAULT_DELAY_FOREVER		((unsigned long) -1)
+
+static uint64_t fault_now_usecs(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return ((uint64_t) tv.tv_sec * 1000000) + tv.tv_usec;
+}
+
+/* Sleep for the given number of microseconds, or until the session ends,
+ * for FAULT_DELAY_FOREVER.  Signals (and thus timers, such as TimeoutStalled)
+ * are still handled while we wait, so that the session can be timed out, or
+ * terminated.
+ */
+static void fault_delay(unsigned long usecs) {
+  uint64_t start, now, deadline;
+  char proctitle[256];
+  int stalled = FALSE;
+
+  if (usecs == 0) {
+    return;
+  }
+
+  start = now = fault_now_usecs();
+  deadline = now + usecs;
+
+  if (usecs == FAULT_DELAY_FOREVER) {
+    pr_trace_msg(trace_channel, 4, "stalling session until it ends");
+    deadline = UINT64_MAX;
+  }
+
+  /* Long delays are visible to ps(1), so that stalled sessions can be
+   * counted.
+   */
+  if (usecs >= FAULT_STALL_USECS) {
+    if (pr_proctitle_get(proctitle, sizeof(proctitle)) >= 0) {
+      pr_proctitle_set("%s - stalled", proctitle);
+
+    } else {
+      *proctitle = '\0';
+    }
+
+    fault_stall.start_usecs = now;
+    fault_stall.stalls++;
+    stalled = TRUE;
+  }
+
+  while (now < deadline) {
+    struct timeval tv;
+    uint64_t remaining;
+
+    remaining = deadline - now;
+    if (remaining > FAULT_STALL_USECS) {
+      remaining = FAULT_STALL_USECS;
+    }
+
+    tv.tv_sec = remaining / 1000000;
+    tv.tv_usec = remaining % 1000000;
+
+    if (select(0, NULL, NULL, NULL, &tv) < 0 &&
+        errno == EINTR) {
+      pr_signals_handle();
+    }
+
+    now = fault_now_usecs();
+  }
+
+  fault_cmd_stats.delay_usecs += (now - start);
+
+  if (stalled == TRUE) {
+    fault_stall.total_usecs += (now - fault_stall.start_usecs);
+    fault_stall.start_usecs = 0;
+
+    if (*proctitle != '\0') {
+      pr_proctitle_set("%s", proctitle);
+    }
+  }
+}
+
+/* Let any interested modules know about an injected fault or delay.  To
+ * keep the common case cheap, nothing is done unless someone is listening.
+ */
+static void fault_event_generate(const char *event, const char *category,
+    const char *oper, const char *path, int xerrno, unsigned long delay_usecs,
+    const char *cause) {
+  struct fault_event_data data;
+
+  if (pr_event_listening(event) <= 0) {
+    return;
+  }
+
+  data.category = category;
+  data.oper = oper;
+  data.path = path;
+  data.xerrno = xerrno;
+  data.delay_usecs = delay_usecs;
+  data.cause = cause;
+
+  pr_event_generate(event, &data);
+}
+
+static void fault_inject_delay(const char *oper, const char *path,
+    unsigned long usecs, const char *cause) {
+  if (usecs == 0) {
+    return;
+  }
+
+  fault_event_generate(FAULT_EVENT_DELAY_INJECTED, "filesystem", oper, path,
+    0, usecs, cause);
+  fault_delay(usecs);
+}
+
 static const char *fault_errno2text(int xerrno) {
   register unsigned int i;
 
@@ -161,467 +842,5261 @@ static int fault_text2errno(const char *text) {
   return -1;
 }
 
-static int fault_get_errno(pr_table_t *tab, const char *oper, int *xerrno) {
-  const void *val = NULL;
+/* xorshift64*; cheap, and good enough for deciding when to inject faults. */
+static double fault_random(void) {
+  uint64_t x;
 
-  val = pr_table_get(tab, oper, NULL);
-  if (val == NULL) {
-    return -1;
-  }
+  x = fault_prng_state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  fault_prng_state = x;
 
-  *xerrno = *((int *) val);
-  return 0;
+  return (double) ((x * 0x2545f4914f6cdd1dULL) >> 11) / 9007199254740992.0;
 }
 
-static int supported_fsio_operation(const char *oper) {
-  register unsigned int i;
+static void fault_random_seed(uint64_t seed) {
+  fault_prng_state = seed != 0 ? seed : 0x853c49e6748fea9bULL;
+}
 
-  for (i = 0; fault_fsio_operations[i] != NULL; i++) {
-    if (strcasecmp(fault_fsio_operations[i], oper) == 0) {
-      return 0;
-    }
+/* Hashes the sampling key (FNV-1a, then a splitmix64 finalizer, so that
+ * similar keys such as adjacent addresses are spread out) into [0, 1).
+ */
+static double fault_sample_hash(const char *key, uint64_t seed) {
+  uint64_t h;
+
+  h = 0xcbf29ce484222325ULL ^ seed;
+  for (; *key != '\0'; key++) {
+    h ^= (unsigned char) *key;
+    h *= 0x100000001b3ULL;
   }
 
-  return -1;
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+
+  return (double) (h >> 11) / 9007199254740992.0;
 }
 
-static int fault_error_dump(const void *key_data, size_t keysz,
-    const void *val_data, size_t valsz, void *user_data) {
-  int xerrno;
+/* Decides whether this session is one of the sampled sessions for which
+ * faults are enabled.
+ */
+static int fault_sample_session(double sample, int sample_by, uint64_t seed) {
+  const char *key = NULL, *by = "address";
+  double val;
 
-  xerrno = *((int *) val_data);
-  pr_trace_msg(trace_channel, 20, "  %.*s: %s (%d) [%s]", (int) keysz,
-    key_data, fault_errno2text(xerrno), xerrno, strerror(xerrno));
-  return 0;
-}
+  if (sample >= 1.0) {
+    return TRUE;
+  }
 
-static void fault_tab_dump(pr_table_t *tab) {
-  (void) pr_table_do(tab, fault_error_dump, NULL, PR_TABLE_DO_FL_ALL);
-}
+  if (sample_by == FAULT_SAMPLE_BY_SESSION) {
+    by = "session";
 
-/* FSIO handlers
- */
+    /* Prefer the ID provided by mod_unique_id, if any. */
+    key = pr_table_get(session.notes, "UNIQUE_ID", NULL);
+    if (key == NULL) {
+      char buf[64];
 
-/* TODO: Rather than defaulting the real system calls, should default to
- * the underlying FSIO module, thus honoring stacking.  In most cases,
- * that underlying FSIO module WILL be "core", i.e. the real system call.
- */
+      pr_snprintf(buf, sizeof(buf)-1, "%lu.%lu", (unsigned long) session.pid,
+        (unsigned long) time(NULL));
+      buf[sizeof(buf)-1] = '\0';
+      key = pstrdup(session.pool, buf);
+    }
 
-static int fault_fsio_chmod(pr_fs_t *fs, const char *path, mode_t mode) {
-  int xerrno = 0;
+  } else {
+    key = pr_netaddr_get_ipstr(session.c->remote_addr);
+  }
 
-  if (fault_get_errno(fault_fsio_errtab, "chmod", &xerrno) < 0) {
-    return chmod(path, mode);
+  if (key == NULL) {
+    key = "";
   }
 
-  pr_trace_msg(trace_channel, 4, "fsio: chmod '%s', returning %s (%s)", path,
-    fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
+  val = fault_sample_hash(key, seed);
+
+  pr_trace_msg(trace_channel, 9,
+    "sampling by %s '%s': %0.4f %s sample %0.4f", by, key, val,
+    val < sample ? "<" : ">=", sample);
+  return (val < sample);
 }
 
-static int fault_fsio_chown(pr_fs_t *fs, const char *path, uid_t uid,
-    gid_t gid) {
-  int xerrno = 0;
+/* Returns the table of rules for the configuration context of the directive
+ * being parsed, creating it as needed.
+ */
+static pr_table_t *fault_get_ruletab(cmd_rec *cmd, const char **context) {
+  config_rec *c, *ctxt = NULL;
+  xaset_t *set;
+
+  if (cmd->config != NULL &&
+      cmd->config->config_type != CONF_PARAM) {
+    ctxt = cmd->config;
+    set = ctxt->subset;
 
-  if (fault_get_errno(fault_fsio_errtab, "chown", &xerrno) < 0) {
-    return chown(path, uid, gid);
+  } else {
+    set = cmd->server->conf;
   }
 
-  pr_trace_msg(trace_channel, 4, "fsio: chown '%s', returning %s (%s)", path,
-    fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
+  c = find_config(set, CONF_PARAM, "FaultRules", FALSE);
+  if (c == NULL) {
+    const char *label = NULL;
+
+    if (ctxt != NULL) {
+      switch (ctxt->config_type) {
+        case CONF_DIR:
+          label = pstrcat(fault_pool, "<Directory ", ctxt->name, ">", NULL);
+          break;
+
+        case CONF_ANON:
+          label = pstrcat(fault_pool, "<Anonymous ", ctxt->name, ">", NULL);
+          break;
+
+        default:
+          label = pstrdup(fault_pool, "<Global>");
+          break;
+      }
+    }
+
+    c = add_config_param("FaultRules", 3, NULL, NULL, NULL);
+    c->argv[0] = pr_table_alloc(fault_pool, 0);
+    c->argv[1] = palloc(c->pool, sizeof(int));
+    *((int *) c->argv[1]) = (ctxt != NULL &&
+      ctxt->config_type == CONF_GLOBAL);
+    c->argv[2] = (void *) label;
+  }
+
+  *context = c->argv[2];
+  return c->argv[0];
 }
 
-static int fault_fsio_chroot(pr_fs_t *fs, const char *path) {
-  int xerrno = 0;
+static struct fault_rule *fault_get_rule(cmd_rec *cmd, const char *oper) {
+  struct fault_rule *rule;
+  pr_table_t *tab;
+  const char *context = NULL;
 
-  if (fault_get_errno(fault_fsio_errtab, "chroot", &xerrno) < 0) {
-    int res;
+  tab = fault_get_ruletab(cmd, &context);
 
-    res = chroot(path);
-    if (res >= 0) {
-      /* Note: Ideally this assignment wouldn't be in an FSIO callback... */
-      session.chroot_path = (char *) path;
-    }
+  rule = (struct fault_rule *) pr_table_get(tab, oper, NULL);
+  if (rule != NULL) {
+    return rule;
+  }
 
-    return res;
+  rule = pcalloc(fault_pool, sizeof(struct fault_rule));
+
+  /* Note that the table API copies the key pointer as is, thus we need to
+   * use a key pointer of a longer lifetime than the parsing record pool.
+   */
+  rule->oper = pstrdup(fault_pool, oper);
+  rule->context = context;
+  rule->error_prob[FAULT_STATE_GOOD] = rule->error_prob[FAULT_STATE_BAD] = 1.0;
+  rule->state = FAULT_STATE_GOOD;
+
+  if (pr_table_add(tab, rule->oper, rule, sizeof(struct fault_rule *)) < 0) {
+    return NULL;
   }
 
-  pr_trace_msg(trace_channel, 4, "fsio: chroot '%s', returning %s (%s)", path,
-    fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
+  return rule;
 }
 
-static int fault_fsio_close(pr_fh_t *fh, int fd) {
-  int xerrno = 0;
+/* Advances the rule's state machine by one call. */
+static void fault_rule_step(struct fault_rule *rule) {
+  rule->calls++;
 
-  if (fault_get_errno(fault_fsio_errtab, "close", &xerrno) < 0) {
-    return close(fd);
+  if (rule->good_to_bad <= 0.0) {
+    return;
   }
 
-  pr_trace_msg(trace_channel, 4, "fsio: close %d ('%s'), returning %s (%s)", fd,
-    fh->fh_path, fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
-}
+  if (rule->state == FAULT_STATE_GOOD) {
+    if (fault_random() < rule->good_to_bad) {
+      rule->state = FAULT_STATE_BAD;
+      rule->bad_periods++;
+      pr_trace_msg(trace_channel, 9, "rule '%s': entering bad state",
+        rule->oper);
+    }
 
-static int fault_fsio_closedir(pr_fs_t *fs, void *dirh) {
-  int xerrno = 0;
+  } else {
+    if (fault_random() < rule->bad_to_good) {
+      rule->state = FAULT_STATE_GOOD;
+      pr_trace_msg(trace_channel, 9, "rule '%s': leaving bad state",
+        rule->oper);
+    }
+  }
 
-  if (fault_get_errno(fault_fsio_errtab, "closedir", &xerrno) < 0) {
-    return closedir((DIR *) dirh);
+  if (rule->state == FAULT_STATE_BAD) {
+    rule->bad_calls++;
   }
+}
 
-  pr_trace_msg(trace_channel, 4, "fsio: closedir, returning %s (%s)",
-    fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
+/* Formats the given handle as a table key.  The handle's pointer is used
+ * as text, since table keys are compared as strings, not as raw bytes.
+ */
+static const char *fault_handle_key(char *buf, size_t bufsz,
+    const void *handle) {
+  pr_snprintf(buf, bufsz, "%p", handle);
+  return buf;
 }
 
-static int fault_fsio_fchmod(pr_fh_t *fh, int fd, mode_t mode) {
-  int xerrno = 0;
+/* Returns the counter of faults injected so far, for the rule's transient
+ * fault scope.
+ */
+static unsigned int *fault_rule_count(struct fault_rule *rule, pr_fh_t *fh,
+    const char *path) {
+  unsigned int *count = NULL;
 
-  if (fault_get_errno(fault_fsio_errtab, "chmod", &xerrno) < 0) {
-    return fchmod(fd, mode);
+  if (rule->fault_scope == FAULT_SCOPE_SESSION ||
+      (fh == NULL && path == NULL)) {
+    return &(rule->faults);
   }
 
-  pr_trace_msg(trace_channel, 4, "fsio: fchmod %d ('%s'), returning %s (%s)",
-    fd, fh->fh_path, fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
-}
+  if (rule->fault_counts == NULL) {
+    rule->fault_counts = pr_table_alloc(session.pool, 0);
+  }
+
+  if (rule->fault_scope == FAULT_SCOPE_HANDLE &&
+      fh != NULL) {
+    char buf[32];
+    const char *key;
+
+    key = fault_handle_key(buf, sizeof(buf), fh);
+    count = (unsigned int *) pr_table_get(rule->fault_counts, key, NULL);
+    if (count == NULL) {
+      count = pcalloc(session.pool, sizeof(unsigned int));
+      (void) pr_table_add(rule->fault_counts, pstrdup(session.pool, key),
+        count, sizeof(unsigned int *));
+    }
+
+    return count;
+  }
+
+  count = (unsigned int *) pr_table_get(rule->fault_counts, path, NULL);
+  if (count == NULL) {
+    count = pcalloc(session.pool, sizeof(unsigned int));
+    (void) pr_table_add(rule->fault_counts, pstrdup(session.pool, path),
+      count, sizeof(unsigned int *));
+  }
+
+  return count;
+}
+
+static void fault_forget_handle_counts(pr_fh_t *fh) {
+  register unsigned int i;
+  struct fault_rule **rules;
+  char buf[32];
+  const char *key;
+
+  key = fault_handle_key(buf, sizeof(buf), fh);
+
+  rules = fault_sess_rules->elts;
+  for (i = 0; i < fault_sess_rules->nelts; i++) {
+    if (rules[i]->fault_scope == FAULT_SCOPE_HANDLE &&
+        rules[i]->fault_counts != NULL) {
+      (void) pr_table_remove(rules[i]->fault_counts, key, NULL);
+    }
+  }
+}
+
+/* Picks one of the rule's errors, according to their weights. */
+static const struct fault_rule_error *fault_rule_pick_error(
+    struct fault_rule *rule) {
+  register unsigned int i;
+  unsigned int target;
+
+  if (rule->nerrors == 1) {
+    return &(rule->errors[0]);
+  }
+
+  target = (unsigned int) (fault_random() * rule->total_weight);
+  for (i = 0; i < rule->nerrors; i++) {
+    if (target < rule->errors[i].weight) {
+      return &(rule->errors[i]);
+    }
+
+    target -= rule->errors[i].weight;
+  }
+
+  return &(rule->errors[rule->nerrors - 1]);
+}
+
+/* Volume emulation */
+
+/* Locks for the state shared by all sessions.  A session process may be
+ * killed at any time, e.g. by a signal, so a waiter checks whether the owner
+ * still exists; if not, the waiter takes the lock over.  (A lock taken by a
+ * process which dies before noting itself as owner is not reclaimed, but the
+ * window for that is only a few instructions.)
+ */
+static void fault_shm_lock(struct fault_shm_lock *lock) {
+  pid_t pid;
+
+  pid = getpid();
+
+  while (__sync_lock_test_and_set(&(lock->locked), 1) != 0) {
+    while (lock->locked != 0) {
+      pid_t owner;
+
+      owner = lock->owner;
+      if (owner != 0 &&
+          kill(owner, 0) < 0 &&
+          errno == ESRCH &&
+          __sync_bool_compare_and_swap(&(lock->owner), owner, pid)) {
+        pr_trace_msg(trace_channel, 1,
+          "reclaimed shared lock held by exited process %lu",
+          (unsigned long) owner);
+        return;
+      }
+
+      sched_yield();
+    }
+  }
+
+  lock->owner = pid;
+}
+
+static void fault_shm_unlock(struct fault_shm_lock *lock) {
+  lock->owner = 0;
+  __sync_lock_release(&(lock->locked));
+}
+
+/* Checks whether the given (absolute) path is at or below the prefix. */
+static int fault_path_has_prefix(const char *path, const char *prefix,
+    size_t prefixlen) {
+  if (prefixlen == 1 &&
+      *prefix == '/') {
+    return TRUE;
+  }
+
+  if (strncmp(path, prefix, prefixlen) != 0) {
+    return FALSE;
+  }
+
+  return (path[prefixlen] == '\0' || path[prefixlen] == '/');
+}
+
+/* Volume paths are configured as real paths, whereas the paths seen by the
+ * FSIO callbacks may be relative to a chroot.
+ */
+static int fault_volume_match(const struct fault_volume *vol,
+    const char *path) {
+  const char *chroot_path;
+
+  if (*path != '/') {
+    path = pr_fs_getcwd();
+  }
+
+  chroot_path = session.chroot_path;
+  if (chroot_path != NULL &&
+      strcmp(chroot_path, "/") != 0) {
+    size_t chroot_len;
+
+    chroot_len = strlen(chroot_path);
+
+    /* The whole chroot is on the volume. */
+    if (fault_path_has_prefix(chroot_path, vol->path, vol->pathlen) == TRUE) {
+      return TRUE;
+    }
+
+    /* The volume is mounted somewhere within the chroot. */
+    if (vol->pathlen > chroot_len &&
+        fault_path_has_prefix(vol->path, chroot_path, chroot_len) == TRUE) {
+      return fault_path_has_prefix(path, vol->path + chroot_len,
+        vol->pathlen - chroot_len);
+    }
+
+    return FALSE;
+  }
+
+  return fault_path_has_prefix(path, vol->path, vol->pathlen);
+}
+
+/* Consumes a credit for each of the nops operations on the volume, delaying
+ * the operation if there are no credits left.
+ */
+static void fault_volume_charge(struct fault_volume *vol, const char *oper,
+    const char *path, unsigned long nops) {
+  struct fault_volume_bucket *bucket;
+  uint64_t now;
+  unsigned long delay_usecs = 0;
+
+  bucket = vol->bucket;
+  now = fault_now_usecs();
+
+  fault_shm_lock(&(bucket->lock));
+
+  if (now > bucket->refill_usecs) {
+    bucket->credits += ((double) (now - bucket->refill_usecs) *
+      vol->baseline_iops) / 1000000.0;
+    if (bucket->credits > vol->burst_credits) {
+      bucket->credits = vol->burst_credits;
+    }
+
+    bucket->refill_usecs = now;
+  }
+
+  bucket->credits -= (double) nops;
+  bucket->ops += nops;
+
+  if (bucket->credits < 0.0) {
+    /* Wait our turn, behind any other queued operations. */
+    delay_usecs = (unsigned long) ((-bucket->credits * 1000000.0) /
+      vol->baseline_iops);
+    bucket->throttled_ops++;
+  }
+
+  fault_shm_unlock(&(bucket->lock));
+
+  vol->ops += nops;
+
+  if (delay_usecs > 0) {
+    vol->throttled_ops++;
+    vol->throttle_usecs += delay_usecs;
+
+    pr_trace_msg(trace_channel, 15,
+      "fsio: %s '%s': volume '%s' out of burst credits, delaying %lu usecs",
+      oper, path, vol->path, delay_usecs);
+    fault_inject_delay(oper, path, delay_usecs, "volume");
+  }
+}
+
+static void fault_volumes_charge(const char *oper, const char *path,
+    unsigned long nops) {
+  register unsigned int i;
+  struct fault_volume **vols;
+
+  vols = fault_volumes->elts;
+  for (i = 0; i < fault_volumes->nelts; i++) {
+    if (fault_volume_match(vols[i], path) == TRUE) {
+      fault_volume_charge(vols[i], oper, path, nops);
+      return;
+    }
+  }
+}
+
+static void fault_volumes_unmap(void) {
+  register unsigned int i;
+  struct fault_volume **vols;
+
+  if (fault_volumes == NULL) {
+    return;
+  }
+
+  vols = fault_volumes->elts;
+  for (i = 0; i < fault_volumes->nelts; i++) {
+    (void) munmap(vols[i]->bucket, sizeof(struct fault_volume_bucket));
+  }
+
+  fault_volumes = NULL;
+}
+
+/* Rule compilation */
+
+#define FAULT_PATH_MAX_DEPTH	64
+
+static int fault_merge_rule(const void *key_data, size_t keysz,
+    const void *val_data, size_t valsz, void *user_data) {
+  pr_table_t *dst;
+
+  dst = user_data;
+
+  /* Rules from the more specific context override those for the same
+   * operation from the less specific context.
+   */
+  if (pr_table_get(dst, key_data, NULL) != NULL) {
+    (void) pr_table_set(dst, key_data, val_data, valsz);
+
+  } else {
+    (void) pr_table_add(dst, key_data, val_data, valsz);
+  }
+
+  return 0;
+}
+
+static void fault_merge_rules(pr_table_t *dst, pr_table_t *src) {
+  (void) pr_table_do(src, fault_merge_rule, dst, PR_TABLE_DO_FL_ALL);
+}
+
+static int fault_add_sess_rule(const void *key_data, size_t keysz,
+    const void *val_data, size_t valsz, void *user_data) {
+  struct fault_rule *rule;
+
+  rule = (struct fault_rule *) val_data;
+  *((struct fault_rule **) push_array(fault_sess_rules)) = rule;
+
+  if (rule->max_faults > 0 &&
+      rule->fault_scope == FAULT_SCOPE_HANDLE) {
+    fault_have_handle_scope = TRUE;
+  }
+
+  if (rule->bandwidth != NULL) {
+    fault_have_bandwidth = TRUE;
+  }
+
+  return 0;
+}
+
+/* Merges the rules configured directly in the given context (not in any
+ * nested contexts) into the table.  Rules from <Global> are merged first, so
+ * that those configured for the server itself take precedence.  Returns the
+ * number of rule tables merged.
+ */
+static int fault_merge_context_rules(pr_table_t *dst, xaset_t *set) {
+  register unsigned int i;
+  int count = 0;
+
+  for (i = 0; i < 2; i++) {
+    config_rec *c;
+
+    c = find_config(set, CONF_PARAM, "FaultRules", FALSE);
+    while (c != NULL) {
+      pr_table_t *tab;
+      int from_global;
+
+      pr_signals_handle();
+
+      tab = c->argv[0];
+      from_global = *((int *) c->argv[1]);
+
+      if ((i == 0 && from_global == TRUE) ||
+          (i == 1 && from_global == FALSE)) {
+        fault_merge_rules(dst, tab);
+        (void) pr_table_do(tab, fault_add_sess_rule, NULL,
+          PR_TABLE_DO_FL_ALL);
+        count++;
+      }
+
+      c = find_config_next(c, c->next, CONF_PARAM, "FaultRules", FALSE);
+    }
+  }
+
+  return count;
+}
+
+static int fault_get_context_engine(xaset_t *set, int engine) {
+  config_rec *c;
+
+  c = find_config(set, CONF_PARAM, "FaultEngine", FALSE);
+  if (c != NULL) {
+    engine = *((int *) c->argv[0]);
+  }
+
+  return engine;
+}
+
+static struct fault_path_node *fault_path_node_child(pool *p,
+    struct fault_path_node *node, const char *name, size_t namelen,
+    int create) {
+  struct fault_path_node *child = NULL;
+
+  if (node->children != NULL) {
+    child = (struct fault_path_node *) pr_table_kget(node->children, name,
+      namelen, NULL);
+  }
+
+  if (child != NULL ||
+      create == FALSE) {
+    return child;
+  }
+
+  if (node->children == NULL) {
+    node->children = pr_table_alloc(p, 0);
+  }
+
+  child = pcalloc(p, sizeof(struct fault_path_node));
+  child->engine = -1;
+
+  (void) pr_table_kadd(node->children, pstrndup(p, name, namelen), namelen,
+    child, sizeof(struct fault_path_node *));
+  return child;
+}
+
+static struct fault_path_node *fault_path_node_add(pool *p,
+    struct fault_path_node *root, const char *path) {
+  struct fault_path_node *node;
+
+  node = root;
+
+  while (*path != '\0') {
+    const char *end;
+    size_t len;
+
+    while (*path == '/') {
+      path++;
+    }
+
+    if (*path == '\0') {
+      break;
+    }
+
+    end = strchr(path, '/');
+    len = end != NULL ? (size_t) (end - path) : strlen(path);
+
+    node = fault_path_node_child(p, node, path, len, TRUE);
+    path += len;
+  }
+
+  return node;
+}
+
+struct fault_compile_ctx {
+  pool *pool;
+  pr_table_t *rules;
+  int engine;
+};
+
+static void fault_path_node_compile(pool *p, struct fault_path_node *node,
+    pr_table_t *rules, int engine);
+
+static int fault_path_node_compile_child(const void *key_data, size_t keysz,
+    const void *val_data, size_t valsz, void *user_data) {
+  struct fault_compile_ctx *ctx;
+
+  ctx = user_data;
+  fault_path_node_compile(ctx->pool, (struct fault_path_node *) val_data,
+    ctx->rules, ctx->engine);
+  return 0;
+}
+
+static void fault_path_node_compile(pool *p, struct fault_path_node *node,
+    pr_table_t *rules, int engine) {
+
+  if (node->rules != NULL) {
+    pr_table_t *merged;
+
+    merged = pr_table_alloc(p, 0);
+    fault_merge_rules(merged, rules);
+    fault_merge_rules(merged, node->rules);
+    rules = merged;
+  }
+
+  if (node->engine != -1) {
+    engine = node->engine;
+  }
+
+  node->compiled = engine == TRUE ? rules : NULL;
+
+  if (node->children != NULL) {
+    struct fault_compile_ctx ctx;
+
+    ctx.pool = p;
+    ctx.rules = rules;
+    ctx.engine = engine;
+
+    (void) pr_table_do(node->children, fault_path_node_compile_child, &ctx,
+      PR_TABLE_DO_FL_ALL);
+  }
+}
+
+/* <Directory> paths are real paths; for chrooted sessions, find where (if
+ * anywhere) the directory appears within the chroot.
+ */
+static const char *fault_dir_sess_path(pool *p, const char *path) {
+  const char *chroot_path;
+  size_t chroot_len;
+
+  chroot_path = session.chroot_path;
+  if (chroot_path == NULL ||
+      strcmp(chroot_path, "/") == 0) {
+    return path;
+  }
+
+  chroot_len = strlen(chroot_path);
+  while (chroot_len > 1 &&
+         chroot_path[chroot_len-1] == '/') {
+    chroot_len--;
+  }
+
+  /* This directory includes the entire chroot. */
+  if (fault_path_has_prefix(chroot_path, path, strlen(path)) == TRUE) {
+    return "/";
+  }
+
+  if (fault_path_has_prefix(path, chroot_path, chroot_len) == TRUE) {
+    return path[chroot_len] != '\0' ? path + chroot_len : "/";
+  }
+
+  return NULL;
+}
+
+static int fault_dir_cmp(const void *a, const void *b) {
+  const config_rec *c1, *c2;
+
+  c1 = *((const config_rec **) a);
+  c2 = *((const config_rec **) b);
+
+  return (int) strlen(c1->name) - (int) strlen(c2->name);
+}
+
+/* Builds the trie of <Directory> paths which have rules or FaultEngine
+ * configured.  Returns NULL if there are none.
+ */
+static struct fault_path_node *fault_compile_dirs(pool *p, xaset_t *set,
+    pr_table_t *rules, int engine) {
+  struct fault_path_node *root = NULL;
+  array_header *dirs;
+  config_rec *c, **elts;
+  register unsigned int i;
+
+  dirs = make_array(p, 0, sizeof(config_rec *));
+
+  c = find_config(set, CONF_DIR, NULL, FALSE);
+  while (c != NULL) {
+    pr_signals_handle();
+
+    if (find_config(c->subset, CONF_PARAM, "FaultRules", FALSE) != NULL ||
+        find_config(c->subset, CONF_PARAM, "FaultEngine", FALSE) != NULL) {
+      *((config_rec **) push_array(dirs)) = c;
+    }
+
+    c = find_config_next(c, c->next, CONF_DIR, NULL, FALSE);
+  }
+
+  if (dirs->nelts == 0) {
+    return NULL;
+  }
+
+  /* Shallower directories first, so that deeper directories, or those
+   * closer to the chroot, take precedence when merging.
+   */
+  elts = dirs->elts;
+  qsort(elts, dirs->nelts, sizeof(config_rec *), fault_dir_cmp);
+
+  root = pcalloc(p, sizeof(struct fault_path_node));
+  root->engine = -1;
+
+  for (i = 0; i < dirs->nelts; i++) {
+    struct fault_path_node *node;
+    char *path;
+    const char *sess_path;
+    size_t pathlen;
+
+    path = pstrdup(p, elts[i]->name);
+
+    /* A final "*" component applies to everything below the directory;
+     * other wildcards are not supported here.
+     */
+    pathlen = strlen(path);
+    if (pathlen > 1 &&
+        path[pathlen-1] == '*' &&
+        path[pathlen-2] == '/') {
+      path[pathlen-1] = '\0';
+      pathlen--;
+    }
+
+    while (pathlen > 1 &&
+           path[pathlen-1] == '/') {
+      path[pathlen-1] = '\0';
+      pathlen--;
+    }
+
+    if (strpbrk(path, "*?[") != NULL) {
+      pr_trace_msg(trace_channel, 3,
+        "ignoring fault rules for wildcard <Directory %s>", elts[i]->name);
+      continue;
+    }
+
+    sess_path = fault_dir_sess_path(p, path);
+    if (sess_path == NULL) {
+      pr_trace_msg(trace_channel, 9,
+        "ignoring fault rules for <Directory %s>, outside of chroot",
+        elts[i]->name);
+      continue;
+    }
+
+    node = fault_path_node_add(p, root, sess_path);
+    if (node->rules == NULL) {
+      node->rules = pr_table_alloc(p, 0);
+    }
+
+    fault_merge_context_rules(node->rules, elts[i]->subset);
+    node->engine = fault_get_context_engine(elts[i]->subset, node->engine);
+  }
+
+  fault_path_node_compile(p, root, rules, engine);
+  return root;
+}
+
+/* Compiles the rules in effect for this session, from the server, any
+ * <Anonymous> context for the logged-in user, and their <Directory>
+ * contexts.
+ */
+static void fault_compile_rules(void) {
+  pr_table_t *rules;
+  xaset_t *set;
+  int engine;
+
+  fault_sess_rules = make_array(session.pool, 0, sizeof(struct fault_rule *));
+  fault_have_handle_scope = FALSE;
+  fault_have_bandwidth = FALSE;
+
+  set = main_server->conf;
+  rules = pr_table_alloc(session.pool, 0);
+  (void) fault_merge_context_rules(rules, set);
+  engine = fault_get_context_engine(set, FALSE);
+
+  if (session.anon_config != NULL) {
+    set = session.anon_config->subset;
+    (void) fault_merge_context_rules(rules, set);
+    engine = fault_get_context_engine(set, engine);
+  }
+
+  fault_sess_ruletab = engine == TRUE ? rules : NULL;
+  fault_sess_dirs = fault_compile_dirs(session.pool, set, rules, engine);
+
+  if (fault_have_bandwidth == TRUE) {
+    fault_track_handles = TRUE;
+  }
+}
+
+/* Finds the rules in effect for the given path. */
+static pr_table_t *fault_lookup_rules(const char *path) {
+  struct fault_path_node *nodes[FAULT_PATH_MAX_DEPTH];
+  unsigned int depth = 0, matched = 0;
+  char buf[PR_TUNABLE_PATH_MAX+1];
+
+  if (fault_sess_dirs == NULL ||
+      path == NULL) {
+    return fault_sess_ruletab;
+  }
+
+  if (*path != '/') {
+    pr_snprintf(buf, sizeof(buf)-1, "%s/%s", pr_fs_getcwd(), path);
+    buf[sizeof(buf)-1] = '\0';
+    path = buf;
+  }
+
+  nodes[0] = fault_sess_dirs;
+
+  while (*path != '\0') {
+    const char *end;
+    size_t len;
+
+    while (*path == '/') {
+      path++;
+    }
+
+    if (*path == '\0') {
+      break;
+    }
+
+    end = strchr(path, '/');
+    len = end != NULL ? (size_t) (end - path) : strlen(path);
+
+    if (len == 2 &&
+        path[0] == '.' &&
+        path[1] == '.') {
+      if (depth > 0) {
+        depth--;
+        if (matched > depth) {
+          matched = depth;
+        }
+      }
+
+    } else if (len != 1 ||
+               path[0] != '.') {
+      if (depth + 1 >= FAULT_PATH_MAX_DEPTH) {
+        break;
+      }
+
+      depth++;
+
+      if (matched == depth - 1) {
+        struct fault_path_node *child;
+
+        child = fault_path_node_child(NULL, nodes[matched], path, len, FALSE);
+        if (child != NULL) {
+          nodes[depth] = child;
+          matched = depth;
+        }
+      }
+    }
+
+    path += len;
+  }
+
+  return nodes[matched]->compiled;
+}
+
+static struct fault_cmd_time *fault_get_cmd_time(const char *name) {
+  register unsigned int i;
+  struct fault_cmd_time *ct;
+
+  if (fault_cmd_times == NULL) {
+    fault_cmd_times = make_array(session.pool, 0,
+      sizeof(struct fault_cmd_time *));
+  }
+
+  for (i = 0; i < fault_cmd_times->nelts; i++) {
+    ct = ((struct fault_cmd_time **) fault_cmd_times->elts)[i];
+    if (strcmp(ct->name, name) == 0) {
+      return ct;
+    }
+  }
+
+  ct = pcalloc(session.pool, sizeof(struct fault_cmd_time));
+  ct->name = pstrdup(session.pool, name);
+  ct->fsio_usecs = pcalloc(session.pool, sizeof(uint64_t) * FAULT_FSIO_NOPS);
+  *((struct fault_cmd_time **) push_array(fault_cmd_times)) = ct;
+
+  return ct;
+}
+
+static void fault_op_start(const char *oper, const char *path) {
+  if (fault_time_ops == FALSE ||
+      fault_op.oper != NULL) {
+    return;
+  }
+
+  fault_op.oper = oper;
+  fault_op.path = path;
+  fault_op.size = 0;
+  fault_op.offset = -1;
+  fault_op.start_usecs = fault_now_usecs();
+}
+
+/* Notes the size and offset, if known, of the read/write in progress. */
+static void fault_op_set_io(size_t size, off_t offset) {
+  if (fault_op.oper == NULL) {
+    return;
+  }
+
+  fault_op.size = size;
+  fault_op.offset = offset;
+}
+
+static const char *fault_op_record_text(pool *p,
+    const struct fault_op_record *rec) {
+  char text[128];
+
+  if (rec->offset >= 0) {
+    pr_snprintf(text, sizeof(text), " (%lu bytes, offset %" PR_LU ")",
+      (unsigned long) rec->size, (pr_off_t) rec->offset);
+
+  } else if (rec->size > 0) {
+    pr_snprintf(text, sizeof(text), " (%lu bytes)", (unsigned long) rec->size);
+
+  } else {
+    *text = '\0';
+  }
+
+  if (rec->path == NULL) {
+    return pstrcat(p, rec->oper, text, NULL);
+  }
+
+  return pstrcat(p, rec->oper, " '", rec->path, "'", text, NULL);
+}
+
+/* Logs the slow operation, then the operations preceding it, oldest first,
+ * with their start times relative to the slow operation.
+ */
+static void fault_slow_op_log(const struct fault_op_record *slow) {
+  register unsigned int i;
+  unsigned int nrecs;
+  pool *tmp_pool;
+
+  tmp_pool = make_sub_pool(session.pool);
+
+  pr_trace_msg(trace_channel, 1,
+    "slow op: %s took %lu ms (user %s, command %s)",
+    fault_op_record_text(tmp_pool, slow),
+    (unsigned long) (slow->elapsed_usecs / 1000),
+    session.user != NULL ? session.user : "none", slow->cmd);
+
+  nrecs = fault_op_count < fault_op_ringsz ? fault_op_count : fault_op_ringsz;
+  for (i = 0; i < nrecs; i++) {
+    const struct fault_op_record *rec;
+
+    rec = &(fault_op_ring[(fault_op_count - nrecs + i) % fault_op_ringsz]);
+    pr_trace_msg(trace_channel, 1,
+      "slow op: previous op %u/%u, %lu ms before: %s took %lu us "
+      "(command %s)", i + 1, nrecs,
+      (unsigned long) ((slow->start_usecs - rec->start_usecs) / 1000),
+      fault_op_record_text(tmp_pool, rec),
+      (unsigned long) rec->elapsed_usecs, rec->cmd);
+  }
+
+  destroy_pool(tmp_pool);
+}
+
+/* Notes the name of the command now being handled, for the ring. */
+static void fault_op_set_cmd(const char *name) {
+  const char *cmd;
+
+  if (fault_op_cmds == NULL) {
+    fault_op_cmds = pr_table_alloc(session.pool, 0);
+  }
+
+  cmd = pr_table_get(fault_op_cmds, name, NULL);
+  if (cmd == NULL) {
+    cmd = pstrdup(session.pool, name);
+    (void) pr_table_add(fault_op_cmds, cmd, cmd, 0);
+  }
+
+  fault_op_cmd = cmd;
+}
+
+/* Logs the operation if slow, then records it in the ring buffer. */
+static void fault_slow_op_check(uint64_t elapsed_usecs) {
+  struct fault_op_record *rec;
+
+  if (elapsed_usecs >= fault_slow_op_usecs) {
+    struct fault_op_record slow;
+
+    /* The operation's path is still valid, as the operation has only just
+     * finished.
+     */
+    slow.oper = fault_op.oper;
+    slow.path = fault_op.path;
+    slow.cmd = fault_op_cmd;
+    slow.size = fault_op.size;
+    slow.offset = fault_op.offset;
+    slow.start_usecs = fault_op.start_usecs;
+    slow.elapsed_usecs = elapsed_usecs;
+
+    fault_slow_op_log(&slow);
+  }
+
+  if (fault_op_ringsz == 0) {
+    return;
+  }
+
+  rec = &(fault_op_ring[fault_op_count % fault_op_ringsz]);
+  rec->oper = fault_op.oper;
+  rec->path = NULL;
+  rec->cmd = fault_op_cmd;
+  rec->size = fault_op.size;
+  rec->offset = fault_op.offset;
+  rec->start_usecs = fault_op.start_usecs;
+  rec->elapsed_usecs = elapsed_usecs;
+
+  fault_op_count++;
+}
+
+/* Attributes the time of the operation in progress, if any, to the current
+ * command (when profiling); operations outside of a command, e.g. during
+ * login, go to session.curr_cmd.
+ */
+static void fault_op_done(void) {
+  uint64_t elapsed_usecs;
+  int xerrno;
+
+  if (fault_op.oper == NULL) {
+    return;
+  }
+
+  xerrno = errno;
+  elapsed_usecs = fault_now_usecs() - fault_op.start_usecs;
+
+  if (fault_profile == TRUE) {
+    register unsigned int i;
+    struct fault_cmd_time *ct;
+
+    ct = fault_cmd_time;
+    if (ct == NULL) {
+      ct = fault_get_cmd_time(session.curr_cmd != NULL ?
+        session.curr_cmd : "none");
+    }
+
+    for (i = 0; i < FAULT_FSIO_NOPS; i++) {
+      if (strcmp(fault_op.oper, fault_fsio_operations[i]) == 0) {
+        ct->fsio_usecs[i] += elapsed_usecs;
+        break;
+      }
+    }
+
+    fault_cmd_stats.fsio_usecs += elapsed_usecs;
+
+    if (fault_xfer.active == TRUE) {
+      fault_xfer.fsio_usecs += elapsed_usecs;
+    }
+  }
+
+  if (fault_slow_op_usecs > 0) {
+    fault_slow_op_check(elapsed_usecs);
+  }
+
+  fault_op.oper = NULL;
+  errno = xerrno;
+}
+
+/* Evaluates the rule, if any, for the given operation: applies any
+ * configured delay, and returns zero, filling in the error to use, if an
+ * error is to be injected.
+ *
+ * When timing operations, this also starts timing the operation, unless the
+ * caller already has; the caller ends it, or we do, if an error is injected.
+ */
+static int fault_get_errno(const char *oper, pr_fh_t *fh, const char *path,
+    const struct fault_rule_error **err) {
+  pr_table_t *tab;
+  struct fault_rule *rule;
+  unsigned int *count = NULL;
+  double prob;
+
+  if (fh != NULL) {
+    path = fh->fh_path;
+  }
+
+  fault_op_start(oper, path);
+
+  /* Operations on handles, and on directory handles, are charged to the
+   * volume of the path with which they were opened.
+   */
+  if (fault_volumes != NULL &&
+      path != NULL) {
+    fault_volumes_charge(oper, path, 1);
+  }
+
+  tab = fault_lookup_rules(path);
+  if (tab == NULL) {
+    return -1;
+  }
+
+  rule = (struct fault_rule *) pr_table_get(tab, oper, NULL);
+  if (rule == NULL) {
+    return -1;
+  }
+
+  fault_rule_step(rule);
+
+  if (rule->delay_usecs[rule->state] > 0) {
+    pr_trace_msg(trace_channel, 15, "fsio: %s, delaying %lu usecs", oper,
+      rule->delay_usecs[rule->state]);
+    fault_inject_delay(oper, path, rule->delay_usecs[rule->state], "rule");
+  }
+
+  if (rule->nerrors == 0) {
+    return -1;
+  }
+
+  if (rule->max_faults > 0) {
+    count = fault_rule_count(rule, fh, path);
+    if (*count >= rule->max_faults) {
+      return -1;
+    }
+  }
+
+  prob = rule->error_prob[rule->state];
+  if (prob < 1.0 &&
+      fault_random() >= prob) {
+    return -1;
+  }
+
+  if (count != NULL &&
+      count != &(rule->faults)) {
+    (*count)++;
+  }
+
+  rule->faults++;
+  *err = fault_rule_pick_error(rule);
+
+  fault_cmd_stats.faults++;
+
+  fault_event_generate(FAULT_EVENT_FAULT_INJECTED, "filesystem", oper, path,
+    (*err)->xerrno, 0, "rule");
+  fault_op_done();
+  return 0;
+}
+
+/* Decides whether the fault just injected should be logged.  The trace
+ * level is checked first, so that when fault logging is not enabled, none of
+ * the message arguments are formatted.
+ */
+static int fault_log_fault(void) {
+  int log_fault = FALSE;
+
+  if (pr_trace_get_level(trace_channel) < 4) {
+    return FALSE;
+  }
+
+  fault_log.seen++;
+
+  switch (fault_log.mode) {
+    case FAULT_LOG_SAMPLE:
+      log_fault = ((fault_log.seen - 1) % fault_log.limit == 0);
+      break;
+
+    case FAULT_LOG_RATE: {
+      time_t now;
+
+      now = time(NULL);
+      if (now != fault_log.window_start) {
+        fault_log.window_start = now;
+        fault_log.window_count = 0;
+      }
+
+      if (fault_log.window_count < fault_log.limit) {
+        fault_log.window_count++;
+        log_fault = TRUE;
+      }
+      break;
+    }
+
+    default:
+      log_fault = TRUE;
+      break;
+  }
+
+  if (log_fault == FALSE) {
+    fault_log.suppressed++;
+    fault_log.pending++;
+    return FALSE;
+  }
+
+  fault_log.logged++;
+
+  if (fault_log.pending > 0) {
+    pr_trace_msg(trace_channel, 4,
+      "(%lu injected %s not logged since the previous one)", fault_log.pending,
+      fault_log.pending != 1 ? "faults" : "fault");
+    fault_log.pending = 0;
+  }
+
+  return TRUE;
+}
+
+static int supported_fsio_operation(const char *oper) {
+  register unsigned int i;
+
+  for (i = 0; fault_fsio_operations[i] != NULL; i++) {
+    if (strcasecmp(fault_fsio_operations[i], oper) == 0) {
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+static int fault_rule_dump(const void *key_data, size_t keysz,
+    const void *val_data, size_t valsz, void *user_data) {
+  const struct fault_rule *rule;
+
+  rule = val_data;
+
+  if (rule->nerrors > 0) {
+    register unsigned int i;
+
+    pr_trace_msg(trace_channel, 20,
+      "  %.*s: probability %0.4f (good), %0.4f (bad), max faults %u",
+      (int) keysz, (const char *) key_data, rule->error_prob[FAULT_STATE_GOOD],
+      rule->error_prob[FAULT_STATE_BAD], rule->max_faults);
+
+    for (i = 0; i < rule->nerrors; i++) {
+      pr_trace_msg(trace_channel, 20, "  %.*s: %s (%d) [%s], weight %u",
+        (int) keysz, (const char *) key_data, rule->errors[i].name,
+        rule->errors[i].xerrno, rule->errors[i].text, rule->errors[i].weight);
+    }
+  }
+
+  if (rule->delay_usecs[FAULT_STATE_GOOD] > 0 ||
+      rule->delay_usecs[FAULT_STATE_BAD] > 0) {
+    pr_trace_msg(trace_channel, 20,
+      "  %.*s: delay %lu usecs (good), %lu usecs (bad)", (int) keysz,
+      (const char *) key_data, rule->delay_usecs[FAULT_STATE_GOOD],
+      rule->delay_usecs[FAULT_STATE_BAD]);
+  }
+
+  if (rule->bandwidth != NULL) {
+    register unsigned int i;
+
+    for (i = 0; i < rule->bandwidth->nsegments; i++) {
+      const struct fault_bandwidth_segment *seg;
+
+      seg = &(rule->bandwidth->segments[i]);
+      pr_trace_msg(trace_channel, 20,
+        "  %.*s: bandwidth %" PR_LU " bytes/sec until %" PR_LU " bytes",
+        (int) keysz, (const char *) key_data, (pr_off_t) seg->rate,
+        (pr_off_t) seg->until);
+    }
+  }
+
+  if (rule->good_to_bad > 0.0) {
+    pr_trace_msg(trace_channel, 20,
+      "  %.*s: burst good-to-bad %0.4f, bad-to-good %0.4f", (int) keysz,
+      (const char *) key_data, rule->good_to_bad, rule->bad_to_good);
+  }
+
+  return 0;
+}
+
+static void fault_rules_dump(void) {
+  register unsigned int i;
+  struct fault_rule **rules;
+
+  rules = fault_sess_rules->elts;
+  for (i = 0; i < fault_sess_rules->nelts; i++) {
+    if (rules[i]->context != NULL) {
+      pr_trace_msg(trace_channel, 20, "  %s: configured in %s",
+        rules[i]->oper, rules[i]->context);
+    }
+
+    (void) fault_rule_dump(rules[i]->oper, strlen(rules[i]->oper), rules[i],
+      sizeof(struct fault_rule *), NULL);
+  }
+}
+
+static void fault_rules_summary(void) {
+  register unsigned int i;
+  struct fault_rule **rules;
+
+  if (fault_sess_rules == NULL) {
+    return;
+  }
+
+  rules = fault_sess_rules->elts;
+  for (i = 0; i < fault_sess_rules->nelts; i++) {
+    const struct fault_rule *rule;
+
+    rule = rules[i];
+    if (rule->calls == 0) {
+      continue;
+    }
+
+    if (rule->context == NULL) {
+      pr_trace_msg(trace_channel, 5,
+        "rule '%s': %lu calls, %u faults, %lu bad periods (%lu calls in bad "
+        "state)", rule->oper, rule->calls, rule->faults, rule->bad_periods,
+        rule->bad_calls);
+
+    } else {
+      pr_trace_msg(trace_channel, 5,
+        "rule '%s' in %s: %lu calls, %u faults, %lu bad periods (%lu calls "
+        "in bad state)", rule->oper, rule->context, rule->calls,
+        rule->faults, rule->bad_periods, rule->bad_calls);
+    }
+  }
+}
+
+/* Parses probabilities such as "0.01" or "1%". */
+static int fault_parse_probability(const char *text, double *prob) {
+  char *ptr = NULL;
+  double val;
+
+  val = strtod(text, &ptr);
+  if (ptr == text) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (*ptr == '%' &&
+      *(ptr + 1) == '\0') {
+    val /= 100.0;
+
+  } else if (*ptr != '\0') {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (val < 0.0 ||
+      val > 1.0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *prob = val;
+  return 0;
+}
+
+/* Parses sizes such as "512", "64KB", "512MB", "16GB"; units are
+ * powers of 1024.
+ */
+static int fault_parse_size(const char *text, off_t *nbytes) {
+  char *ptr = NULL;
+  unsigned long long val;
+  off_t factor = 1;
+
+  if (text == NULL ||
+      *text == '-') {
+    errno = EINVAL;
+    return -1;
+  }
+
+  val = strtoull(text, &ptr, 10);
+  if (ptr == text) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (*ptr != '\0') {
+    if (strcasecmp(ptr, "B") == 0) {
+      factor = 1;
+
+    } else if (strcasecmp(ptr, "K") == 0 ||
+               strcasecmp(ptr, "KB") == 0) {
+      factor = 1024;
+
+    } else if (strcasecmp(ptr, "M") == 0 ||
+               strcasecmp(ptr, "MB") == 0) {
+      factor = 1024 * 1024;
+
+    } else if (strcasecmp(ptr, "G") == 0 ||
+               strcasecmp(ptr, "GB") == 0) {
+      factor = 1024 * 1024 * 1024;
+
+    } else if (strcasecmp(ptr, "T") == 0 ||
+               strcasecmp(ptr, "TB") == 0) {
+      factor = (off_t) 1024 * 1024 * 1024 * 1024;
+
+    } else {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  *nbytes = (off_t) val * factor;
+  return 0;
+}
+
+/* Parses rates such as "50MB" or "50MB/s", in bytes per second. */
+static int fault_parse_rate(pool *p, const char *text, off_t *bps) {
+  size_t len;
+
+  len = strlen(text);
+  if (len > 2 &&
+      strcasecmp(text + len - 2, "/s") == 0) {
+    text = pstrndup(p, text, len - 2);
+  }
+
+  if (fault_parse_size(text, bps) < 0) {
+    return -1;
+  }
+
+  if (*bps == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Parses a throughput curve, e.g. "20MB/s", or "5MB/s:64MB,100MB/s" for
+ * 5 MB/s for the first 64 MB, then 100 MB/s.
+ */
+static struct fault_bandwidth *fault_parse_bandwidth(pool *p,
+    const char *text) {
+  struct fault_bandwidth *bw;
+  char *list, *entry;
+  unsigned int max_count = 1;
+  const char *ptr;
+  off_t prev_until = 0;
+
+  for (ptr = text; *ptr != '\0'; ptr++) {
+    if (*ptr == ',') {
+      max_count++;
+    }
+  }
+
+  bw = pcalloc(p, sizeof(struct fault_bandwidth));
+  bw->segments = pcalloc(p,
+    sizeof(struct fault_bandwidth_segment) * max_count);
+
+  list = pstrdup(p, text);
+  while ((entry = strsep(&list, ",")) != NULL) {
+    struct fault_bandwidth_segment *seg;
+    char *until_text;
+
+    /* Only the last segment may leave out its byte count. */
+    if (bw->nsegments > 0 &&
+        bw->segments[bw->nsegments-1].until == 0) {
+      errno = EINVAL;
+      return NULL;
+    }
+
+    seg = &(bw->segments[bw->nsegments]);
+
+    until_text = strchr(entry, ':');
+    if (until_text != NULL) {
+      *until_text++ = '\0';
+
+      if (fault_parse_size(until_text, &(seg->until)) < 0 ||
+          seg->until <= prev_until) {
+        errno = EINVAL;
+        return NULL;
+      }
+
+      prev_until = seg->until;
+    }
+
+    if (fault_parse_rate(p, entry, &(seg->rate)) < 0) {
+      return NULL;
+    }
+
+    bw->nsegments++;
+  }
+
+  return bw;
+}
+
+/* Parses delays such as "500us", "8ms", "1.5s".  Without units, the value
+ * is taken as milliseconds.
+ */
+static int fault_parse_delay(const char *text, unsigned long *usecs) {
+  char *ptr = NULL;
+  double val, factor = 1000.0;
+
+  if (text == NULL ||
+      *text == '-') {
+    errno = EINVAL;
+    return -1;
+  }
+
+  val = strtod(text, &ptr);
+  if (ptr == text) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (*ptr != '\0') {
+    if (strcasecmp(ptr, "us") == 0) {
+      factor = 1.0;
+
+    } else if (strcasecmp(ptr, "ms") == 0) {
+      factor = 1000.0;
+
+    } else if (strcasecmp(ptr, "s") == 0 ||
+               strcasecmp(ptr, "sec") == 0) {
+      factor = 1000000.0;
+
+    } else {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  *usecs = (unsigned long) (val * factor);
+  return 0;
+}
+
+/* Parses FaultDelay delays; as fault_parse_delay(), but also accepting
+ * "forever", for stalls which end only when the session does.
+ */
+static int fault_parse_stall(const char *text, unsigned long *usecs) {
+  if (text != NULL &&
+      strcasecmp(text, "forever") == 0) {
+    *usecs = FAULT_DELAY_FOREVER;
+    return 0;
+  }
+
+  return fault_parse_delay(text, usecs);
+}
+
+static struct fault_handle *fault_find_handle(pr_fh_t *fh, int fd) {
+  struct fault_handle *h;
+
+  for (h = fault_handles; h != NULL; h = h->next) {
+    if (h->fh == fh &&
+        h->fd == fd) {
+      return h;
+    }
+  }
+
+  return NULL;
+}
+
+static struct fault_handle *fault_get_handle(pr_fh_t *fh, int fd) {
+  struct fault_handle *h;
+  struct stat st;
+
+  h = fault_find_handle(fh, fd);
+  if (h != NULL) {
+    return h;
+  }
+
+  if (fault_free_handles != NULL) {
+    h = fault_free_handles;
+    fault_free_handles = h->next;
+    memset(h, 0, sizeof(struct fault_handle));
+
+  } else {
+    h = pcalloc(session.pool, sizeof(struct fault_handle));
+  }
+
+  h->fh = fh;
+  h->fd = fd;
+
+  if (fstat(fd, &st) == 0) {
+    h->dev = st.st_dev;
+    h->ino = st.st_ino;
+  }
+
+  h->pos = lseek(fd, 0, SEEK_CUR);
+  if (h->pos < 0) {
+    h->pos = 0;
+  }
+
+  h->head = h->pos;
+
+  if (fault_have_bandwidth == TRUE) {
+    pr_table_t *tab;
+
+    tab = fault_lookup_rules(fh->fh_path);
+    if (tab != NULL) {
+      struct fault_rule *rule;
+
+      rule = (struct fault_rule *) pr_table_get(tab, "read", NULL);
+      if (rule != NULL) {
+        h->bandwidth[FAULT_XFER_READ] = rule->bandwidth;
+      }
+
+      rule = (struct fault_rule *) pr_table_get(tab, "write", NULL);
+      if (rule != NULL) {
+        h->bandwidth[FAULT_XFER_WRITE] = rule->bandwidth;
+      }
+    }
+  }
+
+  h->next = fault_handles;
+  fault_handles = h;
+
+  return h;
+}
+
+static void fault_drop_handle(pr_fh_t *fh, int fd) {
+  struct fault_handle *h, *prev = NULL;
+
+  for (h = fault_handles; h != NULL; prev = h, h = h->next) {
+    if (h->fh == fh &&
+        h->fd == fd) {
+      if (prev != NULL) {
+        prev->next = h->next;
+
+      } else {
+        fault_handles = h->next;
+      }
+
+      h->next = fault_free_handles;
+      fault_free_handles = h;
+      return;
+    }
+  }
+}
+
+/* Page cache emulation */
+
+/* Maps the shared memory for a cache of the given size.  The buckets and
+ * pages follow the cache header in the same mapping; since the mapping is
+ * anonymous, it starts zeroed, and the pages are only touched as the cache
+ * fills.
+ */
+static struct fault_page_cache *fault_page_cache_create(off_t cachesz,
+    off_t extentsz, unsigned long cold_usecs) {
+  struct fault_page_cache *cache;
+  unsigned long max_pages, nbuckets = 1;
+  size_t hdrsz, bucketsz, mapsz;
+  void *addr;
+
+  max_pages = (unsigned long) (cachesz / extentsz);
+  if (max_pages == 0) {
+    max_pages = 1;
+  }
+
+  /* Aim for short hash chains, without preallocating a bucket per page for
+   * very large caches.
+   */
+  while (nbuckets < (max_pages / 4) &&
+         nbuckets < (1UL << 20)) {
+    nbuckets <<= 1;
+  }
+
+  hdrsz = (sizeof(struct fault_page_cache) + sizeof(void *) - 1) &
+    ~(sizeof(void *) - 1);
+  bucketsz = sizeof(struct fault_page *) * nbuckets;
+  mapsz = hdrsz + bucketsz + (sizeof(struct fault_page) * max_pages);
+
+  addr = mmap(NULL, mapsz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS,
+    -1, 0);
+  if (addr == MAP_FAILED) {
+    return NULL;
+  }
+
+  cache = addr;
+  cache->mapsz = mapsz;
+  cache->extentsz = extentsz;
+  cache->cold_usecs = cold_usecs;
+  cache->max_pages = max_pages;
+  cache->nbuckets = nbuckets;
+  cache->buckets = (struct fault_page **) ((char *) addr + hdrsz);
+  cache->pages = (struct fault_page *) ((char *) addr + hdrsz + bucketsz);
+
+  return cache;
+}
+
+static void fault_page_cache_unmap(void) {
+  if (fault_page_cache == NULL) {
+    return;
+  }
+
+  (void) munmap(fault_page_cache, fault_page_cache->mapsz);
+  fault_page_cache = NULL;
+}
+
+static unsigned long fault_page_hash(struct fault_page_cache *cache,
+    dev_t dev, ino_t ino, off_t extent) {
+  uint64_t h;
+
+  h = ((uint64_t) dev * 0x9e3779b97f4a7c15ULL) ^
+      ((uint64_t) ino * 0xc2b2ae3d27d4eb4fULL) ^
+      ((uint64_t) extent * 0x165667b19e3779f9ULL);
+  h ^= (h >> 29);
+
+  return (unsigned long) (h & (cache->nbuckets - 1));
+}
+
+static void fault_page_lru_unlink(struct fault_page_cache *cache,
+    struct fault_page *page) {
+  if (page->lru_prev != NULL) {
+    page->lru_prev->lru_next = page->lru_next;
+
+  } else {
+    cache->lru_head = page->lru_next;
+  }
+
+  if (page->lru_next != NULL) {
+    page->lru_next->lru_prev = page->lru_prev;
+
+  } else {
+    cache->lru_tail = page->lru_prev;
+  }
+
+  page->lru_prev = page->lru_next = NULL;
+}
+
+static void fault_page_lru_push(struct fault_page_cache *cache,
+    struct fault_page *page) {
+  page->lru_prev = NULL;
+  page->lru_next = cache->lru_head;
+
+  if (cache->lru_head != NULL) {
+    cache->lru_head->lru_prev = page;
+  }
+
+  cache->lru_head = page;
+
+  if (cache->lru_tail == NULL) {
+    cache->lru_tail = page;
+  }
+}
+
+static void fault_page_hash_unlink(struct fault_page_cache *cache,
+    struct fault_page *page) {
+  struct fault_page **ptr;
+
+  ptr = &(cache->buckets[fault_page_hash(cache, page->dev, page->ino,
+    page->extent)]);
+
+  while (*ptr != NULL) {
+    if (*ptr == page) {
+      *ptr = page->hash_next;
+      page->hash_next = NULL;
+      return;
+    }
+
+    ptr = &((*ptr)->hash_next);
+  }
+}
+
+/* Looks up the given extent, making it the most recently used.  Returns TRUE
+ * if the extent was already cached, FALSE if it had to be added.
+ */
+static int fault_page_cache_touch(struct fault_page_cache *cache, dev_t dev,
+    ino_t ino, off_t extent) {
+  struct fault_page *page;
+  unsigned long idx;
+
+  idx = fault_page_hash(cache, dev, ino, extent);
+
+  for (page = cache->buckets[idx]; page != NULL; page = page->hash_next) {
+    if (page->extent == extent &&
+        page->ino == ino &&
+        page->dev == dev) {
+      if (page != cache->lru_head) {
+        fault_page_lru_unlink(cache, page);
+        fault_page_lru_push(cache, page);
+      }
+
+      return TRUE;
+    }
+  }
+
+  if (cache->npages < cache->max_pages) {
+    page = &(cache->pages[cache->npages++]);
+
+  } else {
+    /* Evict the least recently used page, and reuse it. */
+    page = cache->lru_tail;
+    fault_page_lru_unlink(cache, page);
+    fault_page_hash_unlink(cache, page);
+  }
+
+  page->dev = dev;
+  page->ino = ino;
+  page->extent = extent;
+
+  page->hash_next = cache->buckets[idx];
+  cache->buckets[idx] = page;
+  fault_page_lru_push(cache, page);
+
+  return FALSE;
+}
+
+/* Returns the number of cold (uncached) extents in the given range, which
+ * are now cached.  Reads are counted as hits and misses.
+ */
+static unsigned long fault_page_cache_access(struct fault_page_cache *cache,
+    struct fault_handle *h, off_t offset, size_t len, int reading) {
+  off_t extent, first_extent, last_extent;
+  unsigned long cold = 0, warm;
+
+  if (len == 0) {
+    return 0;
+  }
+
+  first_extent = offset / cache->extentsz;
+  last_extent = (offset + len - 1) / cache->extentsz;
+
+  fault_shm_lock(&(cache->lock));
+
+  for (extent = first_extent; extent <= last_extent; extent++) {
+    if (fault_page_cache_touch(cache, h->dev, h->ino, extent) == FALSE) {
+      cold++;
+    }
+  }
+
+  warm = (unsigned long) (last_extent - first_extent + 1) - cold;
+  if (reading == TRUE) {
+    cache->misses += cold;
+    cache->hits += warm;
+  }
+
+  fault_shm_unlock(&(cache->lock));
+
+  if (reading == TRUE) {
+    fault_page_cache_misses += cold;
+    fault_page_cache_hits += warm;
+  }
+
+  return cold;
+}
+
+static void fault_page_cache_read(struct fault_handle *h, off_t offset,
+    size_t len) {
+  unsigned long cold;
+
+  cold = fault_page_cache_access(fault_page_cache, h, offset, len, TRUE);
+
+  if (cold > 0) {
+    unsigned long delay_usecs;
+
+    delay_usecs = cold * fault_page_cache->cold_usecs;
+    pr_trace_msg(trace_channel, 15,
+      "fsio: read %d ('%s', %lu bytes, %" PR_LU " offset): %lu cold extents, "
+      "delaying %lu usecs", h->fd, h->fh->fh_path, (unsigned long) len,
+      (pr_off_t) offset, cold, delay_usecs);
+    fault_inject_delay("read", h->fh->fh_path, delay_usecs, "page-cache");
+  }
+}
+
+static void fault_page_cache_write(struct fault_handle *h, off_t offset,
+    size_t len) {
+  /* Written data lands in the page cache, and is thus warm for subsequent
+   * reads.
+   */
+  (void) fault_page_cache_access(fault_page_cache, h, offset, len, FALSE);
+}
+
+/* Seek cost emulation */
+
+static void fault_seek_to(struct fault_handle *h, off_t offset,
+    const char *oper) {
+  off_t distance;
+  unsigned long delay_usecs;
+
+  distance = offset > h->head ? offset - h->head : h->head - offset;
+  h->head = offset;
+
+  if (distance == 0) {
+    fault_seek_model->sequential++;
+    return;
+  }
+
+  delay_usecs = (unsigned long) (((double) distance / FAULT_SEEK_GB) *
+    fault_seek_model->usecs_per_gb);
+  if (fault_seek_model->max_seek_usecs > 0 &&
+      delay_usecs > fault_seek_model->max_seek_usecs) {
+    delay_usecs = fault_seek_model->max_seek_usecs;
+  }
+
+  delay_usecs += fault_seek_model->rotational_usecs;
+
+  fault_seek_model->seeks++;
+  fault_seek_model->seek_usecs += delay_usecs;
+
+  pr_trace_msg(trace_channel, 15,
+    "fsio: %s %d ('%s') seeking %" PR_LU " bytes to %" PR_LU " offset, "
+    "delaying %lu usecs", oper, h->fd, h->fh->fh_path, (pr_off_t) distance,
+    (pr_off_t) offset, delay_usecs);
+  fault_inject_delay(oper, h->fh->fh_path, delay_usecs, "seek");
+}
+
+/* Called before reading from the given offset on the handle. */
+static void fault_handle_read_start(struct fault_handle *h, off_t offset) {
+  if (fault_seek_model != NULL) {
+    fault_seek_to(h, offset, "read");
+  }
+}
+
+/* Bandwidth emulation: delay each read/write just enough so that the
+ * handle's overall transfer time is no less than the throughput curve
+ * allows.
+ */
+
+/* Returns the minimum time, in usecs, to transfer nbytes on a handle, and
+ * the rate in effect at that point.
+ */
+static uint64_t fault_bandwidth_usecs(const struct fault_bandwidth *bw,
+    off_t nbytes, off_t *rate) {
+  register unsigned int i;
+  double usecs = 0.0;
+  off_t done = 0;
+
+  for (i = 0; i < bw->nsegments; i++) {
+    const struct fault_bandwidth_segment *seg;
+    off_t len;
+
+    seg = &(bw->segments[i]);
+    *rate = seg->rate;
+
+    len = nbytes - done;
+    if (seg->until > 0 &&
+        i < bw->nsegments - 1 &&
+        seg->until - done < len) {
+      len = seg->until - done;
+    }
+
+    usecs += ((double) len * 1000000.0) / seg->rate;
+    done += len;
+
+    if (done >= nbytes) {
+      break;
+    }
+  }
+
+  return (uint64_t) usecs;
+}
+
+static void fault_bandwidth_throttle(struct fault_handle *h, int dir,
+    size_t len) {
+  uint64_t now, elapsed_usecs, expected_usecs;
+  off_t rate = 0;
+
+  now = fault_now_usecs();
+
+  if (h->xfer_bytes[dir] == 0) {
+    h->xfer_start_usecs[dir] = now;
+  }
+
+  h->xfer_bytes[dir] += len;
+
+  elapsed_usecs = now - h->xfer_start_usecs[dir];
+  expected_usecs = fault_bandwidth_usecs(h->bandwidth[dir], h->xfer_bytes[dir],
+    &rate);
+
+  if (expected_usecs > elapsed_usecs) {
+    unsigned long delay_usecs;
+
+    delay_usecs = (unsigned long) (expected_usecs - elapsed_usecs);
+    pr_trace_msg(trace_channel, 19,
+      "fsio: %s %d ('%s'): %" PR_LU " bytes at %" PR_LU " bytes/sec, "
+      "delaying %lu usecs", dir == FAULT_XFER_READ ? "read" : "write", h->fd,
+      h->fh->fh_path, (pr_off_t) h->xfer_bytes[dir], (pr_off_t) rate,
+      delay_usecs);
+    fault_inject_delay(dir == FAULT_XFER_READ ? "read" : "write",
+      h->fh->fh_path, delay_usecs, "bandwidth");
+  }
+}
+
+/* Called after successfully reading len bytes from the given offset. */
+static void fault_handle_read_done(struct fault_handle *h, off_t offset,
+    size_t len) {
+  if (fault_page_cache != NULL) {
+    fault_page_cache_read(h, offset, len);
+  }
+
+  h->head = offset + len;
+
+  if (h->bandwidth[FAULT_XFER_READ] != NULL) {
+    fault_bandwidth_throttle(h, FAULT_XFER_READ, len);
+  }
+}
+
+/* Returns the rule which applies to sendfile(2) downloads of the given
+ * path: the configured "sendfile" rule, or failing that the "read" rule.
+ */
+static struct fault_rule *fault_sendfile_rule(const char *path,
+    const char **oper) {
+  pr_table_t *tab;
+  struct fault_rule *rule;
+
+  tab = fault_lookup_rules(path);
+  if (tab == NULL) {
+    return NULL;
+  }
+
+  *oper = "sendfile";
+  rule = (struct fault_rule *) pr_table_get(tab, *oper, NULL);
+  if (rule == NULL) {
+    *oper = "read";
+    rule = (struct fault_rule *) pr_table_get(tab, *oper, NULL);
+  }
+
+  return rule;
+}
+
+/* Returns the number of reads, of one transfer buffer each, which a
+ * sendfile(2) download of nbytes saves.
+ */
+static unsigned long fault_sendfile_reads(off_t nbytes) {
+  size_t bufsz;
+
+  bufsz = pr_config_get_server_xfer_bufsz(PR_NETIO_IO_WR);
+  if (bufsz == 0) {
+    bufsz = PR_TUNABLE_BUFFER_SIZE;
+  }
+
+  return (unsigned long) ((nbytes + bufsz - 1) / bufsz);
+}
+
+/* Returns the probability that at least one of n calls fails, when each
+ * fails with the given probability, i.e. 1 - (1 - prob)^n.
+ */
+static double fault_prob_any(double prob, unsigned long n) {
+  double ok, res = 1.0;
+
+  ok = 1.0 - prob;
+  while (n > 0) {
+    if (n & 1) {
+      res *= ok;
+    }
+
+    ok *= ok;
+    n >>= 1;
+  }
+
+  return 1.0 - res;
+}
+
+/* Evaluates the sendfile rule for a download of nbytes.  Returns 0 if a
+ * fault is to be injected, -1 otherwise.
+ *
+ * The download stands in for one read per transfer buffer, but the rule is
+ * only evaluated once, rather than once per read: this is called before the
+ * transfer starts, and evaluating it per read would stall the client, before
+ * the first byte is sent, for all of the per-read delays.  Instead, the
+ * per-read error probability is combined into the probability that any of
+ * the reads fails, and the per-read delays into a single delay, which is
+ * applied once the data has been sent, like the bandwidth cap.  The rule
+ * thus steps through its FaultBurst states once per download.
+ *
+ * The filesystem operation is not timed here; the delays are timed as part
+ * of the close.
+ */
+static int fault_sendfile_check(pr_fh_t *fh, const char *path, off_t nbytes,
+    const struct fault_rule_error **err) {
+  struct fault_rule *rule;
+  const char *oper = NULL;
+  unsigned long nreads, delay_usecs;
+  unsigned int *count = NULL;
+  double prob;
+
+  rule = fault_sendfile_rule(path, &oper);
+  if (rule == NULL) {
+    return -1;
+  }
+
+  nreads = fault_sendfile_reads(nbytes);
+
+  pr_trace_msg(trace_channel, 15,
+    "fsio: '%s' (%" PR_LU " bytes) to be sent using sendfile, applying '%s' "
+    "rule for %lu reads", path, (pr_off_t) nbytes, oper, nreads);
+
+  fault_rule_step(rule);
+
+  /* A "forever" delay, or one too long to represent, stays "forever". */
+  delay_usecs = rule->delay_usecs[rule->state];
+  if (delay_usecs > 0 &&
+      delay_usecs != FAULT_DELAY_FOREVER) {
+    if (nreads > FAULT_DELAY_FOREVER / delay_usecs) {
+      delay_usecs = FAULT_DELAY_FOREVER;
+
+    } else {
+      delay_usecs *= nreads;
+    }
+  }
+
+  fault_retr.delay_usecs = delay_usecs;
+
+  if (rule->nerrors == 0) {
+    return -1;
+  }
+
+  if (rule->max_faults > 0) {
+    count = fault_rule_count(rule, fh, path);
+    if (*count >= rule->max_faults) {
+      return -1;
+    }
+  }
+
+  prob = rule->error_prob[rule->state];
+  if (prob < 1.0) {
+    prob = fault_prob_any(prob, nreads);
+    if (fault_random() >= prob) {
+      return -1;
+    }
+  }
+
+  if (count != NULL &&
+      count != &(rule->faults)) {
+    (*count)++;
+  }
+
+  rule->faults++;
+  *err = fault_rule_pick_error(rule);
+
+  fault_cmd_stats.faults++;
+
+  fault_event_generate(FAULT_EVENT_FAULT_INJECTED, "filesystem", oper, path,
+    (*err)->xerrno, 0, "rule");
+  return 0;
+}
+
+/* Applies the costs of a sendfile(2) download of nbytes, once the data has
+ * been sent: the volume credits of the reads saved, the combined per-read
+ * delay, and any bandwidth cap.
+ */
+static void fault_sendfile_done(pr_fh_t *fh, off_t nbytes) {
+  struct fault_rule *rule;
+  const char *oper = "sendfile";
+  uint64_t elapsed_usecs, expected_usecs;
+  off_t rate = 0;
+
+  if (fault_volumes != NULL) {
+    fault_volumes_charge(oper, fh->fh_path, fault_sendfile_reads(nbytes));
+  }
+
+  rule = fault_sendfile_rule(fh->fh_path, &oper);
+  if (rule == NULL) {
+    return;
+  }
+
+  if (fault_retr.delay_usecs > 0) {
+    pr_trace_msg(trace_channel, 15, "fsio: sendfile '%s', delaying %lu usecs",
+      fh->fh_path, fault_retr.delay_usecs);
+    fault_inject_delay(oper, fh->fh_path, fault_retr.delay_usecs, "rule");
+    fault_retr.delay_usecs = 0;
+  }
+
+  if (rule->bandwidth == NULL) {
+    return;
+  }
+
+  elapsed_usecs = fault_now_usecs() - fault_retr.start_usecs;
+  expected_usecs = fault_bandwidth_usecs(rule->bandwidth, nbytes, &rate);
+
+  if (expected_usecs > elapsed_usecs) {
+    unsigned long delay_usecs;
+
+    delay_usecs = (unsigned long) (expected_usecs - elapsed_usecs);
+    pr_trace_msg(trace_channel, 19,
+      "fsio: sendfile '%s': %" PR_LU " bytes at %" PR_LU " bytes/sec, "
+      "delaying %lu usecs", fh->fh_path, (pr_off_t) nbytes,
+      (pr_off_t) rate, delay_usecs);
+    fault_inject_delay(oper, fh->fh_path, delay_usecs, "bandwidth");
+  }
+}
+
+/* Predicts whether mod_xfer will send the current download using
+ * sendfile(2), using the same checks that it does: binary mode, no
+ * TransferRate, UseSendfile not disabled, and no other module handling the
+ * data connection I/O (e.g. mod_tls).
+ */
+static int fault_retr_uses_sendfile(void) {
+#if defined(HAVE_SENDFILE)
+  config_rec *c;
+  pr_netio_t *netio;
+
+  if (session.sf_flags & (SF_ASCII|SF_ASCII_OVERRIDE)) {
+    return FALSE;
+  }
+
+  if (pr_throttle_have_rate()) {
+    return FALSE;
+  }
+
+  c = find_config(CURRENT_CONF, CONF_PARAM, "UseSendfile", FALSE);
+  if (c != NULL &&
+      *((unsigned char *) c->argv[0]) == FALSE) {
+    return FALSE;
+  }
+
+  netio = pr_get_netio(PR_NETIO_STRM_DATA);
+  if (netio != NULL &&
+      netio != fault_netio) {
+    return FALSE;
+  }
+
+  return TRUE;
+#else
+  return FALSE;
+#endif /* HAVE_SENDFILE */
+}
+
+/* Write-back emulation */
+
+static unsigned long fault_writeback_usecs(off_t nbytes) {
+  return (unsigned long) (((double) nbytes * 1000000.0) /
+    fault_writeback->flush_bps);
+}
+
+static void fault_writeback_dirty(struct fault_handle *h, size_t len) {
+  h->dirty += len;
+
+  if (fault_writeback->max_dirty > 0 &&
+      h->dirty > fault_writeback->max_dirty) {
+    off_t excess;
+    unsigned long delay_usecs;
+
+    /* Too much dirty data; the writer now waits for some of it to be
+     * written back.
+     */
+    excess = h->dirty - fault_writeback->max_dirty;
+    delay_usecs = fault_writeback_usecs(excess);
+    h->dirty = fault_writeback->max_dirty;
+
+    pr_trace_msg(trace_channel, 15,
+      "fsio: write %d ('%s'): dirty limit reached, throttling %" PR_LU
+      " bytes, delaying %lu usecs", h->fd, h->fh->fh_path, (pr_off_t) excess,
+      delay_usecs);
+    fault_inject_delay("write", h->fh->fh_path, delay_usecs, "write-back");
+  }
+}
+
+static void fault_writeback_flush(struct fault_handle *h, const char *oper) {
+  unsigned long delay_usecs;
+
+  if (h->dirty == 0) {
+    return;
+  }
+
+  delay_usecs = fault_writeback_usecs(h->dirty);
+
+  fault_writeback->flushes++;
+  fault_writeback->flushed_bytes += h->dirty;
+  fault_writeback->flush_usecs += delay_usecs;
+  if (delay_usecs > fault_writeback->max_flush_usecs) {
+    fault_writeback->max_flush_usecs = delay_usecs;
+  }
+
+  pr_trace_msg(trace_channel, 15,
+    "fsio: %s %d ('%s'): flushing %" PR_LU " dirty bytes, delaying %lu usecs",
+    oper, h->fd, h->fh->fh_path, (pr_off_t) h->dirty, delay_usecs);
+  h->dirty = 0;
+  fault_inject_delay(oper, h->fh->fh_path, delay_usecs, "write-back");
+}
+
+/* Called after successfully writing len bytes at the given offset. */
+static void fault_handle_write_done(struct fault_handle *h, off_t offset,
+    size_t len) {
+  if (fault_page_cache != NULL) {
+    fault_page_cache_write(h, offset, len);
+  }
+
+  if (fault_writeback != NULL) {
+    fault_writeback_dirty(h, len);
+  }
+
+  if (h->bandwidth[FAULT_XFER_WRITE] != NULL) {
+    fault_bandwidth_throttle(h, FAULT_XFER_WRITE, len);
+  }
+}
+
+static void fault_dir_add(void *dirh, const char *path) {
+  char buf[32];
+
+  if (fault_dir_pool == NULL) {
+    fault_dir_pool = make_sub_pool(session.pool);
+    pr_pool_tag(fault_dir_pool, MOD_FAULT_VERSION " directory handles");
+
+    fault_dir_paths = pr_table_alloc(fault_dir_pool, 0);
+  }
+
+  /* Relative paths, e.g. mod_ls' ".", are resolved now, lest the current
+   * directory change before the handle is read.
+   */
+  if (*path != '/') {
+    path = pstrcat(fault_dir_pool, pr_fs_getcwd(), "/", path, NULL);
+
+  } else {
+    path = pstrdup(fault_dir_pool, path);
+  }
+
+  (void) pr_table_add(fault_dir_paths,
+    pstrdup(fault_dir_pool, fault_handle_key(buf, sizeof(buf), dirh)), path,
+    sizeof(char *));
+}
+
+static const char *fault_dir_get(void *dirh) {
+  char buf[32];
+
+  if (fault_dir_paths == NULL) {
+    return NULL;
+  }
+
+  return pr_table_get(fault_dir_paths,
+    fault_handle_key(buf, sizeof(buf), dirh), NULL);
+}
+
+static void fault_dir_remove(void *dirh) {
+  char buf[32];
+
+  if (fault_dir_paths == NULL) {
+    return;
+  }
+
+  (void) pr_table_remove(fault_dir_paths,
+    fault_handle_key(buf, sizeof(buf), dirh), NULL);
+  if (pr_table_count(fault_dir_paths) == 0) {
+    destroy_pool(fault_dir_pool);
+    fault_dir_pool = NULL;
+    fault_dir_paths = NULL;
+  }
+}
+
+/* FSIO handlers
+ */
+
+/* TODO: Rather than defaulting the real system calls, should default to
+ * the underlying FSIO module, thus honoring stacking.  In most cases,
+ * that underlying FSIO module WILL be "core", i.e. the real system call.
+ */
+
+static void fault_profile_io(int dir, off_t offset, size_t bufsz,
+    ssize_t res) {
+  register unsigned int i;
+  unsigned int bucket = 0;
+  size_t sz;
+  struct fault_io_profile *profiles[2];
+
+  for (sz = bufsz; sz > 1 && bucket < FAULT_PROFILE_NBUCKETS-1; sz >>= 1) {
+    bucket++;
+  }
+
+  profiles[0] = &(fault_cmd_profile[dir]);
+  profiles[1] = &(fault_sess_profile[dir]);
+
+  for (i = 0; i < 2; i++) {
+    struct fault_io_profile *prof;
+
+    prof = profiles[i];
+    prof->calls++;
+    prof->sizes[bucket]++;
+
+    if (res > 0) {
+      prof->bytes += res;
+    }
+
+    if (offset % FAULT_PROFILE_ALIGN != 0) {
+      prof->unaligned_offsets++;
+    }
+
+    if (bufsz % FAULT_PROFILE_ALIGN != 0) {
+      prof->unaligned_sizes++;
+    }
+  }
+}
+
+/* Logs the profile, e.g. "read: 16 calls, 1048576 bytes, 16.0 calls/MB,
+ * sizes 64K:16, unaligned offsets 0, unaligned sizes 0".
+ */
+static void fault_profile_log(const char *label, int dir,
+    const struct fault_io_profile *prof) {
+  register unsigned int i;
+  char sizes[512];
+  size_t len = 0;
+  double calls_per_mb = 0.0;
+
+  if (prof->calls == 0) {
+    return;
+  }
+
+  *sizes = '\0';
+  for (i = 0; i < FAULT_PROFILE_NBUCKETS; i++) {
+    unsigned long sz;
+    const char *units = "";
+
+    if (prof->sizes[i] == 0) {
+      continue;
+    }
+
+    sz = 1UL << i;
+    if (sz >= 1024 * 1024) {
+      sz /= (1024 * 1024);
+      units = "M";
+
+    } else if (sz >= 1024) {
+      sz /= 1024;
+      units = "K";
+    }
+
+    len += snprintf(sizes + len, sizeof(sizes) - len, "%s%lu%s%s:%lu",
+      len > 0 ? " " : "", sz, units,
+      i == FAULT_PROFILE_NBUCKETS-1 ? "+" : "", prof->sizes[i]);
+    if (len >= sizeof(sizes)) {
+      break;
+    }
+  }
+
+  if (prof->bytes > 0) {
+    calls_per_mb = (double) prof->calls /
+      ((double) prof->bytes / (1024.0 * 1024.0));
+  }
+
+  pr_trace_msg(trace_channel, 5,
+    "profile: %s %s: %lu calls, %" PR_LU " bytes, %0.1f calls/MB, sizes %s, "
+    "unaligned offsets %lu, unaligned sizes %lu", label,
+    dir == FAULT_XFER_READ ? "read" : "write", prof->calls,
+    (pr_off_t) prof->bytes, calls_per_mb, sizes, prof->unaligned_offsets,
+    prof->unaligned_sizes);
+}
+
+/* Logs where each command's time went, e.g. "LIST: 3 commands, 1900 ms
+ * total, 1840 ms in filesystem (82% readdir, 15% opendir)".  The
+ * percentages are of the command's total time; for operations outside of a
+ * command, of the filesystem time.
+ */
+static void fault_cmd_times_log(void) {
+  register unsigned int i;
+
+  if (fault_cmd_times == NULL) {
+    return;
+  }
+
+  for (i = 0; i < fault_cmd_times->nelts; i++) {
+    register unsigned int j;
+    const struct fault_cmd_time *ct;
+    uint64_t fsio_usecs = 0, total_usecs;
+    char opers[512];
+    size_t len = 0;
+    int done[FAULT_FSIO_NOPS];
+
+    ct = ((struct fault_cmd_time **) fault_cmd_times->elts)[i];
+
+    for (j = 0; j < FAULT_FSIO_NOPS; j++) {
+      fsio_usecs += ct->fsio_usecs[j];
+      done[j] = (ct->fsio_usecs[j] == 0);
+    }
+
+    total_usecs = ct->total_usecs > 0 ? ct->total_usecs : fsio_usecs;
+    if (total_usecs == 0) {
+      continue;
+    }
+
+    /* List the operations by time, most first. */
+    *opers = '\0';
+    for (j = 0; j < FAULT_FSIO_NOPS; j++) {
+      register unsigned int k;
+      int max = -1;
+
+      for (k = 0; k < FAULT_FSIO_NOPS; k++) {
+        if (done[k] == FALSE &&
+            (max < 0 ||
+             ct->fsio_usecs[k] > ct->fsio_usecs[max])) {
+          max = k;
+        }
+      }
+
+      if (max < 0) {
+        break;
+      }
+
+      done[max] = TRUE;
+      len += snprintf(opers + len, sizeof(opers) - len, "%s%0.0f%% %s",
+        len > 0 ? ", " : "",
+        ((double) ct->fsio_usecs[max] * 100.0) / total_usecs,
+        fault_fsio_operations[max]);
+      if (len >= sizeof(opers)) {
+        break;
+      }
+    }
+
+    pr_trace_msg(trace_channel, 5,
+      "profile: command %s: %lu commands, %lu ms total, %lu ms in filesystem "
+      "(%s)", ct->name, ct->count, (unsigned long) (total_usecs / 1000),
+      (unsigned long) (fsio_usecs / 1000), *opers != '\0' ? opers : "none");
+  }
+}
+
+static int fault_fsio_chmod(pr_fs_t *fs, const char *path, mode_t mode) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("chmod", NULL, path, &err) < 0) {
+    int res;
+
+    res = chmod(path, mode);
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4, "fsio: chmod '%s', returning %s (%s)", path,
+      err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_chown(pr_fs_t *fs, const char *path, uid_t uid,
+    gid_t gid) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("chown", NULL, path, &err) < 0) {
+    int res;
+
+    res = chown(path, uid, gid);
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4, "fsio: chown '%s', returning %s (%s)", path,
+      err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_chroot(pr_fs_t *fs, const char *path) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("chroot", NULL, path, &err) < 0) {
+    int res;
+
+    res = chroot(path);
+    if (res >= 0) {
+      /* Note: Ideally this assignment wouldn't be in an FSIO callback... */
+      session.chroot_path = (char *) path;
+    }
+
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4, "fsio: chroot '%s', returning %s (%s)", path,
+      err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_close(pr_fh_t *fh, int fd) {
+  int res = -1;
+  const struct fault_rule_error *err = NULL;
+
+  /* Include any sendfile or write-back costs in the close. */
+  fault_op_start("close", fh->fh_path);
+
+  if (fault_retr.active == TRUE) {
+    off_t nbytes;
+
+    fault_retr.active = FALSE;
+    nbytes = session.xfer.total_bytes;
+
+    if (fault_retr.reads > 0) {
+      fault_retr_count[FAULT_RETR_VIA_READ]++;
+      fault_retr_bytes[FAULT_RETR_VIA_READ] += nbytes;
+
+    } else if (nbytes > 0) {
+      fault_retr_count[FAULT_RETR_VIA_SENDFILE]++;
+      fault_retr_bytes[FAULT_RETR_VIA_SENDFILE] += nbytes;
+
+      /* If the download was not predicted to use sendfile, the rule could
+       * not be checked beforehand; the data has already been sent, thus any
+       * injected error can only be reported for the close.
+       */
+      if (fault_retr.checked == FALSE) {
+        res = fault_sendfile_check(fh, fh->fh_path, nbytes, &err);
+      }
+
+      fault_sendfile_done(fh, nbytes);
+    }
+  }
+
+  if (fault_track_handles == TRUE) {
+    if (fault_writeback != NULL) {
+      struct fault_handle *h;
+
+      /* Note that the flush cost is paid even if the close then fails, as
+       * it would be for e.g. NFS.
+       */
+      h = fault_find_handle(fh, fd);
+      if (h != NULL) {
+        fault_writeback_flush(h, "close");
+      }
+    }
+
+    fault_drop_handle(fh, fd);
+  }
+
+  if (res < 0) {
+    res = fault_get_errno("close", fh, fh->fh_path, &err);
+  }
+
+  /* This handle is done; forget any per-handle transient fault counts. */
+  if (fault_have_handle_scope == TRUE) {
+    fault_forget_handle_counts(fh);
+  }
+
+  if (res < 0) {
+    res = close(fd);
+    fault_op_done();
+    return res;
+  }
+
+  fault_op_done();
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4,
+      "fsio: close %d ('%s'), returning %s (%s)", fd,
+      fh->fh_path, err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_closedir(pr_fs_t *fs, void *dirh) {
+  const struct fault_rule_error *err = NULL;
+  const char *path;
+
+  path = fault_dir_get(dirh);
+  if (fault_get_errno("closedir", NULL, path, &err) < 0) {
+    int res;
+
+    fault_dir_remove(dirh);
+    res = closedir((DIR *) dirh);
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4, "fsio: closedir '%s', returning %s (%s)",
+      path != NULL ? path : "(unknown)", err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_fchmod(pr_fh_t *fh, int fd, mode_t mode) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("chmod", fh, fh->fh_path, &err) < 0) {
+    int res;
+
+    res = fchmod(fd, mode);
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4, "fsio: fchmod %d ('%s'), returning %s (%s)",
+      fd, fh->fh_path, err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_fchown(pr_fh_t *fh, int fd, uid_t uid, gid_t gid) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("chown", fh, fh->fh_path, &err) < 0) {
+    int res;
+
+    res = fchown(fd, uid, gid);
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4, "fsio: fchown %d ('%s'), returning %s (%s)",
+      fd, fh->fh_path, err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_fsync(pr_fh_t *fh, int fd) {
+  const struct fault_rule_error *err = NULL;
+
+  fault_op_start("fsync", fh->fh_path);
+
+  if (fault_writeback != NULL) {
+    struct fault_handle *h;
+
+    h = fault_find_handle(fh, fd);
+    if (h != NULL) {
+      fault_writeback_flush(h, "fsync");
+    }
+  }
+
+  if (fault_get_errno("fsync", fh, fh->fh_path, &err) < 0) {
+    int res;
+
+    res = fsync(fd);
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4, "fsio: fsync %d ('%s'), returning %s (%s)",
+      fd, fh->fh_path, err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_futimes(pr_fh_t *fh, int fd, struct timeval *tvs) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("utimes", fh, fh->fh_path, &err) < 0) {
+    int res;
+
+#if defined(HAVE_FUTIMES)
+    res = futimes(fd, tvs);
+    if (res < 0 &&
+        errno == ENOSYS) {
+      res = utimes(fh->fh_path, tvs);
+    }
+#else
+    res = utimes(fh->fh_path, tvs);
+#endif /* HAVE_FUTIMES */
+
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4, "fsio: futimes (%d) '%s', returning %s (%s)",
+      fd, fh->fh_path, err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_lchown(pr_fs_t *fs, const char *path, uid_t uid,
+    gid_t gid) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("chown", NULL, path, &err) < 0) {
+    int res;
+
+    res = lchown(path, uid, gid);
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4, "fsio: lchown '%s', returning %s (%s)", path,
+      err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static off_t fault_fsio_lseek(pr_fh_t *fh, int fd, off_t offset, int whence) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("lseek", fh, fh->fh_path, &err) < 0) {
+    struct fault_handle *h;
+    off_t res;
+
+    if (fault_track_handles == FALSE) {
+      res = lseek(fd, offset, whence);
+      fault_op_done();
+      return res;
+    }
+
+    /* Look up the handle before seeking, so that a newly tracked handle
+     * starts at the current offset.
+     */
+    h = fault_get_handle(fh, fd);
+
+    res = lseek(fd, offset, whence);
+    if (res >= 0) {
+      h->pos = res;
+
+      if (fault_seek_model != NULL) {
+        fault_seek_to(h, res, "lseek");
+      }
+    }
+
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4,
+      "fsio: lseek %d ('%s'), returning %s (%s)", fd,
+      fh->fh_path, err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_mkdir(pr_fs_t *fs, const char *path, mode_t mode) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("mkdir", NULL, path, &err) < 0) {
+    int res;
+
+    res = mkdir(path, mode);
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4, "fsio: mkdir '%s', returning %s (%s)", path,
+      err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static void *fault_fsio_opendir(pr_fs_t *fs, const char *path) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("opendir", NULL, path, &err) < 0) {
+    void *res;
+
+    res = opendir(path);
+    if (res != NULL) {
+      fault_dir_add(res, path);
+    }
+
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4,
+      "fsio: opendir '%s', returning %s (%s)", path,
+      err->name, err->text);
+  }
+  errno = err->xerrno;
+  return NULL;
+}
+
+static ssize_t fault_fsio_pread(pr_fh_t *fh, int fd, void *buf, size_t bufsz,
+    off_t offset) {
+  const struct fault_rule_error *err = NULL;
+
+  fault_retr.reads++;
+
+  /* For fault injection purposes, we treat `pread(2)` just like `read(2)`. */
+  if (fault_get_errno("read", fh, fh->fh_path, &err) < 0) {
+#if defined(HAVE_PREAD)
+    struct fault_handle *h;
+    ssize_t res;
+
+    fault_op_set_io(bufsz, offset);
+
+    if (fault_track_handles == FALSE) {
+      res = pread(fd, buf, bufsz, offset);
+      fault_op_done();
+      return res;
+    }
+
+    h = fault_get_handle(fh, fd);
+    fault_handle_read_start(h, offset);
+
+    res = pread(fd, buf, bufsz, offset);
+    if (res > 0) {
+      fault_handle_read_done(h, offset, res);
+    }
+
+    if (fault_profile == TRUE) {
+      fault_profile_io(FAULT_XFER_READ, offset, bufsz, res);
+    }
+
+    fault_op_done();
+    return res;
+#else
+    fault_op_done();
+    errno = ENOSYS;
+    return -1;
+#endif /* HAVE_PREAD */
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4,
+      "fsio: pread %d ('%s', %lu bytes, %" PR_LU " offset), returning %s (%s)",
+      fd, fh->fh_path, (unsigned long) bufsz, (pr_off_t) offset,
+      err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static ssize_t fault_fsio_pwrite(pr_fh_t *fh, int fd, const void *buf,
+    size_t bufsz, off_t offset) {
+  const struct fault_rule_error *err = NULL;
+
+  /* For fault injection purposes, we treat `pwrite(2)` just like `write(2)`. */
+  if (fault_get_errno("write", fh, fh->fh_path, &err) < 0) {
+#if defined(HAVE_PWRITE)
+    struct fault_handle *h;
+    ssize_t res;
+
+    fault_op_set_io(bufsz, offset);
+
+    if (fault_track_handles == FALSE) {
+      res = pwrite(fd, buf, bufsz, offset);
+      fault_op_done();
+      return res;
+    }
+
+    h = fault_get_handle(fh, fd);
+
+    res = pwrite(fd, buf, bufsz, offset);
+    if (res > 0) {
+      fault_handle_write_done(h, offset, res);
+    }
+
+    if (fault_profile == TRUE) {
+      fault_profile_io(FAULT_XFER_WRITE, offset, bufsz, res);
+    }
+
+    fault_op_done();
+    return res;
+#else
+    fault_op_done();
+    errno = ENOSYS;
+    return -1;
+#endif /* HAVE_PWRITE */
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4,
+      "fsio: pwrite %d ('%s', %lu bytes, %" PR_LU " offset), returning %s (%s)",
+      fd, fh->fh_path, (unsigned long) bufsz, (pr_off_t) offset,
+      err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_read(pr_fh_t *fh, int fd, char *buf, size_t bufsz) {
+  const struct fault_rule_error *err = NULL;
+
+  fault_retr.reads++;
+
+  if (fault_get_errno("read", fh, fh->fh_path, &err) < 0) {
+    struct fault_handle *h;
+    int res;
+
+    if (fault_track_handles == FALSE) {
+      fault_op_set_io(bufsz, -1);
+      res = read(fd, buf, bufsz);
+      fault_op_done();
+      return res;
+    }
+
+    h = fault_get_handle(fh, fd);
+    fault_op_set_io(bufsz, h->pos);
+    fault_handle_read_start(h, h->pos);
+
+    res = read(fd, buf, bufsz);
+
+    if (fault_profile == TRUE) {
+      fault_profile_io(FAULT_XFER_READ, h->pos, bufsz, res);
+    }
+
+    if (res > 0) {
+      fault_handle_read_done(h, h->pos, res);
+      h->pos += res;
+    }
+
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4,
+      "fsio: read %d ('%s', %lu bytes), returning %s (%s)", fd, fh->fh_path,
+      (unsigned long) bufsz, err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static struct dirent *fault_fsio_readdir(pr_fs_t *fs, void *dirh) {
+  const struct fault_rule_error *err = NULL;
+  const char *path;
+
+  path = fault_dir_get(dirh);
+  if (fault_get_errno("readdir", NULL, path, &err) < 0) {
+    struct dirent *res;
+
+    res = readdir((DIR *) dirh);
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4, "fsio: readdir '%s', returning %s (%s)",
+      path != NULL ? path : "(unknown)", err->name, err->text);
+  }
+  errno = err->xerrno;
+  return NULL;
+}
+
+static int fault_fsio_readlink(pr_fs_t *fs, const char *path, char *buf,
+    size_t bufsz) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("readlink", NULL, path, &err) < 0) {
+    int res;
+
+    res = readlink(path, buf, bufsz);
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4,
+      "fsio: readlink '%s', returning %s (%s)", path,
+      err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_rename(pr_fs_t *fs, const char *src_path,
+    const char *dst_path) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("rename", NULL, src_path, &err) < 0) {
+    int res;
+
+    res = rename(src_path, dst_path);
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4,
+      "fsio: rename '%s' to '%s', returning %s (%s)",
+      src_path, dst_path, err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_rmdir(pr_fs_t *fs, const char *path) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("rmdir", NULL, path, &err) < 0) {
+    int res;
+
+    res = rmdir(path);
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4, "fsio: rmdir '%s', returning %s (%s)", path,
+      err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_write(pr_fh_t *fh, int fd, const char *buf,
+    size_t bufsz) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("write", fh, fh->fh_path, &err) < 0) {
+    struct fault_handle *h;
+    int res;
+
+    if (fault_track_handles == FALSE) {
+      fault_op_set_io(bufsz, -1);
+      res = write(fd, buf, bufsz);
+      fault_op_done();
+      return res;
+    }
+
+    /* Look up the handle before writing, so that a newly tracked handle
+     * starts at the current offset.
+     */
+    h = fault_get_handle(fh, fd);
+    fault_op_set_io(bufsz, h->pos);
+
+    res = write(fd, buf, bufsz);
+
+    if (fault_profile == TRUE) {
+      fault_profile_io(FAULT_XFER_WRITE, h->pos, bufsz, res);
+    }
+
+    if (res > 0) {
+      fault_handle_write_done(h, h->pos, res);
+      h->pos += res;
+    }
+
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4,
+      "fsio: write %d ('%s', %lu bytes), returning %s (%s)", fd, fh->fh_path,
+      (unsigned long) bufsz, err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_unlink(pr_fs_t *fs, const char *path) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("unlink", NULL, path, &err) < 0) {
+    int res;
+
+    res = unlink(path);
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4, "fsio: unlink '%s', returning %s (%s)", path,
+      err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+static int fault_fsio_utimes(pr_fs_t *fs, const char *path,
+    struct timeval *tvs) {
+  const struct fault_rule_error *err = NULL;
+
+  if (fault_get_errno("utimes", NULL, path, &err) < 0) {
+    int res;
+
+    res = utimes(path, tvs);
+    fault_op_done();
+    return res;
+  }
+
+  if (fault_log_fault() == TRUE) {
+    pr_trace_msg(trace_channel, 4, "fsio: utimes '%s', returning %s (%s)", path,
+      err->name, err->text);
+  }
+  errno = err->xerrno;
+  return -1;
+}
+
+/* Configuration handlers
+ */
+
+/* Options are given as "name=value" parameters, mixed in with the list of
+ * operations.
+ */
+static const char *fault_get_option(const char *param, const char *name) {
+  size_t namelen;
+
+  namelen = strlen(name);
+  if (strncasecmp(param, name, namelen) == 0 &&
+      param[namelen] == '=') {
+    return param + namelen + 1;
+  }
+
+  return NULL;
+}
+
+/* usage: FaultEngine on|off [sample=P] [by=address|session] [seed=N] */
+MODRET set_faultengine(cmd_rec *cmd) {
+  register unsigned int i;
+  int engine = -1, sample_by = FAULT_SAMPLE_BY_ADDRESS;
+  double sample = 1.0;
+  uint64_t seed = 0;
+  config_rec *c;
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 5) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL|CONF_ANON|CONF_DIR);
+
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
+
+  for (i = 2; i < cmd->argc; i++) {
+    const char *param, *val;
+
+    param = cmd->argv[i];
+
+    val = fault_get_option(param, "sample");
+    if (val != NULL) {
+      if (fault_parse_probability(val, &sample) < 0) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid sample: ", val,
+          NULL));
+      }
+
+      continue;
+    }
+
+    val = fault_get_option(param, "by");
+    if (val != NULL) {
+      if (strcasecmp(val, "address") == 0) {
+        sample_by = FAULT_SAMPLE_BY_ADDRESS;
+
+      } else if (strcasecmp(val, "session") == 0) {
+        sample_by = FAULT_SAMPLE_BY_SESSION;
+
+      } else {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid by: ", val, NULL));
+      }
+
+      continue;
+    }
+
+    val = fault_get_option(param, "seed");
+    if (val != NULL) {
+      char *ptr = NULL;
+
+      seed = (uint64_t) strtoull(val, &ptr, 10);
+      if (ptr == val ||
+          *ptr != '\0') {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid seed: ", val, NULL));
+      }
+
+      continue;
+    }
+
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown option: ", param, NULL));
+  }
+
+  /* Sampling selects whole sessions, before any <Anonymous> or <Directory>
+   * context is known.
+   */
+  if (cmd->argc > 2 &&
+      cmd->config != NULL &&
+      (cmd->config->config_type == CONF_ANON ||
+       cmd->config->config_type == CONF_DIR)) {
+    CONF_ERROR(cmd, "sampling options not supported in this context");
+  }
+
+  c = add_config_param(cmd->argv[0], 4, NULL, NULL, NULL, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+  c->argv[1] = palloc(c->pool, sizeof(double));
+  *((double *) c->argv[1]) = sample;
+  c->argv[2] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[2]) = sample_by;
+  c->argv[3] = palloc(c->pool, sizeof(uint64_t));
+  *((uint64_t *) c->argv[3]) = seed;
+
+  return PR_HANDLED(cmd);
+}
+
+static int fault_check_category(const char *category) {
+  /* The other categories, e.g. "netio", are handled by the directives which
+   * support them.
+   */
+  if (strcasecmp(category, "filesystem") != 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Parses a list of errnos, optionally weighted, e.g. "EIO" or
+ * "EAGAIN:90,EIO:10".  Commas and/or whitespace separate the entries.
+ */
+static int fault_parse_errors(pool *p, const char *text, unsigned int *nerrors,
+    struct fault_rule_error **errors, unsigned int *total_weight,
+    const char **bad_entry) {
+  char *list, *entry;
+  unsigned int count = 0, max_count = 1;
+  const char *ptr;
+
+  for (ptr = text; *ptr != '\0'; ptr++) {
+    if (*ptr == ',' ||
+        *ptr == ' ' ||
+        *ptr == '\t') {
+      max_count++;
+    }
+  }
+
+  *errors = pcalloc(p, sizeof(struct fault_rule_error) * max_count);
+  *total_weight = 0;
+
+  list = pstrdup(p, text);
+  while ((entry = strsep(&list, ", \t")) != NULL) {
+    char *weight_text;
+    int xerrno;
+    unsigned int weight = 1;
+
+    if (*entry == '\0') {
+      continue;
+    }
+
+    *bad_entry = entry;
+
+    weight_text = strchr(entry, ':');
+    if (weight_text != NULL) {
+      char *tmp = NULL;
+      long val;
+
+      *weight_text++ = '\0';
+      val = strtol(weight_text, &tmp, 10);
+      if (tmp == weight_text ||
+          *tmp != '\0' ||
+          val <= 0) {
+        errno = EINVAL;
+        return -1;
+      }
+
+      weight = (unsigned int) val;
+    }
+
+    xerrno = fault_text2errno(entry);
+    if (xerrno < 0) {
+      errno = ENOENT;
+      return -1;
+    }
+
+    (*errors)[count].xerrno = xerrno;
+    (*errors)[count].name = fault_errno2text(xerrno);
+    (*errors)[count].text = pstrdup(p, strerror(xerrno));
+    (*errors)[count].weight = weight;
+    *total_weight += weight;
+    count++;
+  }
+
+  if (count == 0) {
+    *bad_entry = text;
+    errno = EINVAL;
+    return -1;
+  }
+
+  *nerrors = count;
+  return 0;
+}
+
+/* Returns TRUE if the given FaultInject parameter is an error list entry,
+ * e.g. "EIO" or "EIO:10", rather than an operation or option.  Weighted
+ * entries are always treated as errors, so that a misspelled name is
+ * reported as such.
+ */
+static int fault_is_error_param(pool *p, const char *param) {
+  char *name;
+  size_t namelen;
+
+  if (strchr(param, '=') != NULL) {
+    return FALSE;
+  }
+
+  if (strchr(param, ':') != NULL) {
+    return TRUE;
+  }
+
+  namelen = strcspn(param, ", \t");
+  name = pstrndup(p, param, namelen);
+  if (fault_text2errno(name) < 0) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Handles the "netio" category of FaultInject and FaultDelay, e.g.:
+ *
+ *  FaultInject netio ECONNRESET data after=1MB
+ *  FaultDelay netio 60s data at=10s
+ */
+static int fault_set_netio_rule(cmd_rec *cmd, unsigned int nerrors,
+    struct fault_rule_error *errors, unsigned int total_weight,
+    unsigned long delay_usecs, unsigned int first_arg, const char **errmsg) {
+  register unsigned int i;
+  struct fault_netio_rule *nrule;
+  config_rec *c;
+  int strm_type = 0;
+
+  if (cmd->config != NULL &&
+      (cmd->config->config_type == CONF_ANON ||
+       cmd->config->config_type == CONF_DIR)) {
+    *errmsg = "netio faults not supported in this context";
+    return -1;
+  }
+
+  nrule = pcalloc(fault_pool, sizeof(struct fault_netio_rule));
+  nrule->rule.nerrors = nerrors;
+  nrule->rule.errors = errors;
+  nrule->rule.total_weight = total_weight;
+  nrule->rule.error_prob[FAULT_STATE_GOOD] = 1.0;
+  nrule->rule.error_prob[FAULT_STATE_BAD] = 1.0;
+  nrule->rule.delay_usecs[FAULT_STATE_GOOD] = delay_usecs;
+  nrule->rule.delay_usecs[FAULT_STATE_BAD] = delay_usecs;
+
+  for (i = first_arg; i < cmd->argc; i++) {
+    const char *param, *val;
+
+    param = cmd->argv[i];
+
+    val = fault_get_option(param, "after");
+    if (val != NULL) {
+      if (fault_parse_size(val, &(nrule->after_bytes)) < 0) {
+        *errmsg = pstrcat(cmd->tmp_pool, "invalid after: ", val, NULL);
+        return -1;
+      }
+
+      continue;
+    }
+
+    val = fault_get_option(param, "at");
+    if (val != NULL) {
+      if (fault_parse_delay(val, &(nrule->after_usecs)) < 0) {
+        *errmsg = pstrcat(cmd->tmp_pool, "invalid at: ", val, NULL);
+        return -1;
+      }
+
+      continue;
+    }
+
+    val = fault_get_option(param, "probability");
+    if (val != NULL) {
+      double prob;
+
+      if (fault_parse_probability(val, &prob) < 0) {
+        *errmsg = pstrcat(cmd->tmp_pool, "invalid probability: ", val, NULL);
+        return -1;
+      }
+
+      nrule->rule.error_prob[FAULT_STATE_GOOD] = prob;
+      nrule->rule.error_prob[FAULT_STATE_BAD] = prob;
+      continue;
+    }
+
+    val = fault_get_option(param, "count");
+    if (val != NULL) {
+      char *ptr = NULL;
+      long count;
+
+      count = strtol(val, &ptr, 10);
+      if (ptr == val ||
+          *ptr != '\0' ||
+          count <= 0) {
+        *errmsg = pstrcat(cmd->tmp_pool, "invalid count: ", val, NULL);
+        return -1;
+      }
+
+      nrule->rule.max_faults = (unsigned int) count;
+      continue;
+    }
+
+    val = fault_get_option(param, "burst");
+    if (val != NULL) {
+      char *ptr = NULL;
+      long burst;
+
+      burst = strtol(val, &ptr, 10);
+      if (ptr == val ||
+          *ptr != '\0' ||
+          burst <= 0) {
+        *errmsg = pstrcat(cmd->tmp_pool, "invalid burst: ", val, NULL);
+        return -1;
+      }
+
+      nrule->burst = (unsigned int) burst;
+      continue;
+    }
+
+    if (strchr(param, '=') != NULL) {
+      *errmsg = pstrcat(cmd->tmp_pool, "unknown option: ", param, NULL);
+      return -1;
+    }
+
+    if (strcasecmp(param, "ctrl") == 0) {
+      strm_type = PR_NETIO_STRM_CTRL;
+
+    } else if (strcasecmp(param, "data") == 0) {
+      strm_type = PR_NETIO_STRM_DATA;
+
+    } else {
+      *errmsg = pstrcat(cmd->tmp_pool,
+        "unknown/unsupported netio stream: ", param, NULL);
+      return -1;
+    }
+
+    if (nrule->strm_type != 0) {
+      *errmsg = "only one netio stream, ctrl or data, is supported";
+      return -1;
+    }
+
+    nrule->strm_type = strm_type;
+  }
+
+  if (nrule->strm_type == 0) {
+    *errmsg = "missing netio stream: ctrl or data";
+    return -1;
+  }
+
+  nrule->rule.oper = nrule->strm_type == PR_NETIO_STRM_CTRL ? "ctrl" : "data";
+
+  c = add_config_param("FaultNetIO", 1, NULL);
+  c->argv[0] = nrule;
+
+  return 0;
+}
+
+/* usage: FaultFragment netio max-bytes ctrl|data ... [read|write] */
+MODRET set_faultfragment(cmd_rec *cmd) {
+  register unsigned int i;
+  config_rec *c;
+  off_t max_io = 0;
+  int strm_types = 0, dirs = 0;
+
+  if (cmd->argc < 4) {
+    CONF_ERROR(cmd, "missing parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (strcasecmp(cmd->argv[1], "netio") != 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unsupported category: ",
+      (char *) cmd->argv[1], NULL));
+  }
+
+  if (fault_parse_size(cmd->argv[2], &max_io) < 0 ||
+      max_io == 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid size: ",
+      (char *) cmd->argv[2], NULL));
+  }
+
+  for (i = 3; i < cmd->argc; i++) {
+    const char *param;
+
+    param = cmd->argv[i];
+
+    if (strcasecmp(param, "ctrl") == 0) {
+      strm_types |= PR_NETIO_STRM_CTRL;
+
+    } else if (strcasecmp(param, "data") == 0) {
+      strm_types |= PR_NETIO_STRM_DATA;
+
+    } else if (strcasecmp(param, "read") == 0) {
+      dirs |= FAULT_FRAGMENT_READ;
+
+    } else if (strcasecmp(param, "write") == 0) {
+      dirs |= FAULT_FRAGMENT_WRITE;
+
+    } else {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown parameter: ", param,
+        NULL));
+    }
+  }
+
+  if (strm_types == 0) {
+    CONF_ERROR(cmd, "missing netio stream: ctrl or data");
+  }
+
+  if (dirs == 0) {
+    dirs = FAULT_FRAGMENT_READ|FAULT_FRAGMENT_WRITE;
+  }
+
+  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(size_t));
+  *((size_t *) c->argv[0]) = (size_t) max_io;
+  c->argv[1] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[1]) = strm_types;
+  c->argv[2] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[2]) = dirs;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: FaultInject category error[:weight][,error[:weight] ...]
+ *          [error[:weight] ...] oper1 ... [probability=P]
+ *          [bad-probability=P] [count=K] [scope=session|handle|path]
+ */
+MODRET set_faultinject(cmd_rec *cmd) {
+  register unsigned int i;
+  unsigned int first_arg = 3;
+  const char *error_category, *error_text, *bad_entry = NULL;
+  int have_bad_prob = FALSE, fault_scope = FAULT_SCOPE_SESSION;
+  unsigned int nerrors = 0, total_weight = 0, max_faults = 0;
+  struct fault_rule_error *errors = NULL;
+  double error_prob = 1.0, bad_error_prob = 1.0;
+
+  if (cmd->argc < 4) {
+    CONF_ERROR(cmd, "missing parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL|CONF_ANON|CONF_DIR);
+
+  error_category = cmd->argv[1];
+  if (fault_check_category(error_category) < 0 &&
+      strcasecmp(error_category, "netio") != 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unsupported category: ",
+      error_category, NULL));
+  }
+
+  /* The errors may be given as separate parameters, e.g. "EAGAIN:90 EIO:10",
+   * as well as a comma-separated list.
+   */
+  error_text = cmd->argv[2];
+  while (first_arg < cmd->argc &&
+         fault_is_error_param(cmd->tmp_pool, cmd->argv[first_arg]) == TRUE) {
+    error_text = pstrcat(cmd->tmp_pool, error_text, " ",
+      (char *) cmd->argv[first_arg], NULL);
+    first_arg++;
+  }
+
+  if (first_arg == cmd->argc) {
+    CONF_ERROR(cmd, "missing parameters");
+  }
+
+  if (fault_parse_errors(fault_pool, error_text, &nerrors, &errors,
+      &total_weight, &bad_entry) < 0) {
+    if (errno == ENOENT) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown/unsupported error: ",
+        bad_entry, NULL));
+    }
+
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "badly formatted error: ",
+      bad_entry, NULL));
+  }
+
+  if (strcasecmp(error_category, "netio") == 0) {
+    const char *errmsg = NULL;
+
+    if (fault_set_netio_rule(cmd, nerrors, errors, total_weight, 0,
+        first_arg, &errmsg) < 0) {
+      CONF_ERROR(cmd, errmsg);
+    }
+
+    return PR_HANDLED(cmd);
+  }
+
+  for (i = first_arg; i < cmd->argc; i++) {
+    const char *param, *val;
+
+    param = cmd->argv[i];
+
+    val = fault_get_option(param, "probability");
+    if (val != NULL) {
+      if (fault_parse_probability(val, &error_prob) < 0) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid probability: ", val,
+          NULL));
+      }
+
+      continue;
+    }
+
+    val = fault_get_option(param, "bad-probability");
+    if (val != NULL) {
+      if (fault_parse_probability(val, &bad_error_prob) < 0) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid bad-probability: ",
+          val, NULL));
+      }
+
+      have_bad_prob = TRUE;
+      continue;
+    }
+
+    val = fault_get_option(param, "count");
+    if (val != NULL) {
+      char *ptr = NULL;
+      long count;
+
+      count = strtol(val, &ptr, 10);
+      if (ptr == val ||
+          *ptr != '\0' ||
+          count <= 0) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid count: ", val, NULL));
+      }
+
+      max_faults = (unsigned int) count;
+      continue;
+    }
+
+    val = fault_get_option(param, "scope");
+    if (val != NULL) {
+      if (strcasecmp(val, "session") == 0) {
+        fault_scope = FAULT_SCOPE_SESSION;
+
+      } else if (strcasecmp(val, "handle") == 0) {
+        fault_scope = FAULT_SCOPE_HANDLE;
+
+      } else if (strcasecmp(val, "path") == 0) {
+        fault_scope = FAULT_SCOPE_PATH;
+
+      } else {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid scope: ", val, NULL));
+      }
+
+      continue;
+    }
+
+    if (strchr(param, '=') != NULL) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown option: ", param, NULL));
+    }
+  }
+
+  if (have_bad_prob == FALSE) {
+    bad_error_prob = error_prob;
+  }
+
+  for (i = first_arg; i < cmd->argc; i++) {
+    const char *oper;
+    struct fault_rule *rule;
+
+    oper = cmd->argv[i];
+    if (strchr(oper, '=') != NULL) {
+      continue;
+    }
+
+    if (supported_fsio_operation(oper) < 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
+        "unknown/unsupported ", error_category, " operation: ", oper, NULL));
+    }
+
+    rule = fault_get_rule(cmd, oper);
+    if (rule == NULL) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
+        "error configuring ", error_category, " fault injection for '", oper,
+        "': ", strerror(errno), NULL));
+    }
+
+    if (rule->nerrors > 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, error_category,
+        " configuration already exists for '", oper, "'", NULL));
+    }
+
+    rule->nerrors = nerrors;
+    rule->errors = errors;
+    rule->total_weight = total_weight;
+    rule->max_faults = max_faults;
+    rule->fault_scope = fault_scope;
+    rule->error_prob[FAULT_STATE_GOOD] = error_prob;
+    rule->error_prob[FAULT_STATE_BAD] = bad_error_prob;
+  }
+
+  return PR_HANDLED(cmd);
+}
+
+/* Handles the "command" category of FaultDelay, e.g.:
+ *
+ *  FaultDelay command 50ms PASV EPSV [user=name] [class=name]
+ */
+static int fault_set_command_delay(cmd_rec *cmd, unsigned long delay_usecs,
+    const char **errmsg) {
+  register unsigned int i;
+  struct fault_command_delay *delay;
+  config_rec *c;
+
+  if (cmd->config != NULL &&
+      cmd->config->config_type == CONF_DIR) {
+    *errmsg = "command delays not supported in <Directory>";
+    return -1;
+  }
+
+  c = add_config_param("FaultCommandDelay", 1, NULL);
+  delay = pcalloc(c->pool, sizeof(struct fault_command_delay));
+  delay->commands = make_array(c->pool, 0, sizeof(char *));
+  delay->delay_usecs = delay_usecs;
+
+  for (i = 3; i < cmd->argc; i++) {
+    const char *param, *val;
+
+    param = cmd->argv[i];
+
+    val = fault_get_option(param, "user");
+    if (val != NULL) {
+      delay->user = pstrdup(c->pool, val);
+      continue;
+    }
+
+    val = fault_get_option(param, "class");
+    if (val != NULL) {
+      delay->class_name = pstrdup(c->pool, val);
+      continue;
+    }
+
+    if (strchr(param, '=') != NULL) {
+      *errmsg = pstrcat(cmd->tmp_pool, "unknown option: ", param, NULL);
+      return -1;
+    }
+
+    *((char **) push_array(delay->commands)) = pstrdup(c->pool, param);
+  }
+
+  if (delay->commands->nelts == 0) {
+    *errmsg = "missing commands";
+    return -1;
+  }
+
+  c->argv[0] = delay;
+  return 0;
+}
+
+static int fault_get_auth_operation(const char *oper) {
+  register unsigned int i;
+
+  for (i = 0; fault_auth_operations[i] != NULL; i++) {
+    if (strcasecmp(fault_auth_operations[i], oper) == 0) {
+      return (int) i;
+    }
+  }
+
+  return -1;
+}
+
+/* Handles the "auth" category of FaultDelay, e.g.:
+ *
+ *  FaultDelay auth 200ms getpwnam auth
+ */
+static int fault_set_auth_delay(cmd_rec *cmd, unsigned long delay_usecs,
+    const char **errmsg) {
+  register unsigned int i;
+
+  if (cmd->config != NULL &&
+      (cmd->config->config_type == CONF_ANON ||
+       cmd->config->config_type == CONF_DIR)) {
+    *errmsg = "auth delays not supported in this context";
+    return -1;
+  }
+
+  for (i = 3; i < cmd->argc; i++) {
+    const char *oper;
+    config_rec *c;
+    int idx;
+
+    oper = cmd->argv[i];
+
+    if (strcasecmp(oper, "ALL") != 0) {
+      idx = fault_get_auth_operation(oper);
+      if (idx < 0) {
+        *errmsg = pstrcat(cmd->tmp_pool,
+          "unknown/unsupported auth operation: ", oper, NULL);
+        return -1;
+      }
+
+    } else {
+      idx = -1;
+    }
+
+    c = add_config_param("FaultAuthDelay", 2, NULL, NULL);
+    c->argv[0] = palloc(c->pool, sizeof(int));
+    *((int *) c->argv[0]) = idx;
+    c->argv[1] = palloc(c->pool, sizeof(unsigned long));
+    *((unsigned long *) c->argv[1]) = delay_usecs;
+  }
+
+  return 0;
+}
+
+/* usage: FaultDelay category delay oper1 ... [bad-delay=delay] */
+MODRET set_faultdelay(cmd_rec *cmd) {
+  register unsigned int i;
+  const char *category;
+  unsigned long delay_usecs = 0, bad_delay_usecs = 0;
+  int have_bad_delay = FALSE;
+
+  if (cmd->argc < 4) {
+    CONF_ERROR(cmd, "missing parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL|CONF_ANON|CONF_DIR);
+
+  category = cmd->argv[1];
+  if (fault_check_category(category) < 0 &&
+      strcasecmp(category, "auth") != 0 &&
+      strcasecmp(category, "command") != 0 &&
+      strcasecmp(category, "netio") != 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unsupported category: ",
+      category, NULL));
+  }
+
+  if (fault_parse_stall(cmd->argv[2], &delay_usecs) < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid delay: ",
+      (char *) cmd->argv[2], NULL));
+  }
+
+  if (strcasecmp(category, "auth") == 0 ||
+      strcasecmp(category, "netio") == 0 ||
+      strcasecmp(category, "command") == 0) {
+    const char *errmsg = NULL;
+    int res;
+
+    if (strcasecmp(category, "auth") == 0) {
+      res = fault_set_auth_delay(cmd, delay_usecs, &errmsg);
+
+    } else if (strcasecmp(category, "netio") == 0) {
+      res = fault_set_netio_rule(cmd, 0, NULL, 0, delay_usecs, 3, &errmsg);
+
+    } else {
+      res = fault_set_command_delay(cmd, delay_usecs, &errmsg);
+    }
+
+    if (res < 0) {
+      CONF_ERROR(cmd, errmsg);
+    }
+
+    return PR_HANDLED(cmd);
+  }
+
+  for (i = 3; i < cmd->argc; i++) {
+    const char *val;
+
+    val = fault_get_option(cmd->argv[i], "bad-delay");
+    if (val != NULL) {
+      if (fault_parse_stall(val, &bad_delay_usecs) < 0) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid bad-delay: ", val,
+          NULL));
+      }
+
+      have_bad_delay = TRUE;
+      continue;
+    }
+
+    if (strchr(cmd->argv[i], '=') != NULL) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown option: ",
+        (char *) cmd->argv[i], NULL));
+    }
+  }
+
+  if (have_bad_delay == FALSE) {
+    bad_delay_usecs = delay_usecs;
+  }
+
+  for (i = 3; i < cmd->argc; i++) {
+    const char *oper;
+    struct fault_rule *rule;
+
+    oper = cmd->argv[i];
+    if (strchr(oper, '=') != NULL) {
+      continue;
+    }
+
+    if (supported_fsio_operation(oper) < 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
+        "unknown/unsupported ", category, " operation: ", oper, NULL));
+    }
+
+    rule = fault_get_rule(cmd, oper);
+    if (rule == NULL) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
+        "error configuring ", category, " delay for '", oper, "': ",
+        strerror(errno), NULL));
+    }
+
+    if (rule->delay_usecs[FAULT_STATE_GOOD] > 0 ||
+        rule->delay_usecs[FAULT_STATE_BAD] > 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, category,
+        " delay already configured for '", oper, "'", NULL));
+    }
+
+    rule->delay_usecs[FAULT_STATE_GOOD] = delay_usecs;
+    rule->delay_usecs[FAULT_STATE_BAD] = bad_delay_usecs;
+  }
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: FaultBandwidth category rate[:bytes][,rate[:bytes] ...] read|write ...
+ */
+MODRET set_faultbandwidth(cmd_rec *cmd) {
+  register unsigned int i;
+  const char *category;
+  struct fault_bandwidth *bw;
+
+  if (cmd->argc < 4) {
+    CONF_ERROR(cmd, "missing parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL|CONF_ANON|CONF_DIR);
+
+  category = cmd->argv[1];
+  if (fault_check_category(category) < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unsupported category: ",
+      category, NULL));
+  }
+
+  bw = fault_parse_bandwidth(fault_pool, cmd->argv[2]);
+  if (bw == NULL) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid rate: ",
+      (char *) cmd->argv[2], NULL));
+  }
+
+  for (i = 3; i < cmd->argc; i++) {
+    const char *oper;
+    struct fault_rule *rule;
+
+    oper = cmd->argv[i];
+
+    if (strcasecmp(oper, "read") != 0 &&
+        strcasecmp(oper, "sendfile") != 0 &&
+        strcasecmp(oper, "write") != 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
+        "unsupported ", category, " bandwidth operation: ", oper, NULL));
+    }
+
+    rule = fault_get_rule(cmd, oper);
+    if (rule == NULL) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
+        "error configuring ", category, " bandwidth for '", oper, "': ",
+        strerror(errno), NULL));
+    }
+
+    if (rule->bandwidth != NULL) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, category,
+        " bandwidth already configured for '", oper, "'", NULL));
+    }
+
+    rule->bandwidth = bw;
+  }
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: FaultBurst category good-to-bad bad-to-good oper1 ... */
+MODRET set_faultburst(cmd_rec *cmd) {
+  register unsigned int i;
+  const char *category;
+  double good_to_bad = 0.0, bad_to_good = 0.0;
+
+  if (cmd->argc < 5) {
+    CONF_ERROR(cmd, "missing parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL|CONF_ANON|CONF_DIR);
+
+  category = cmd->argv[1];
+  if (fault_check_category(category) < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unsupported category: ",
+      category, NULL));
+  }
+
+  if (fault_parse_probability(cmd->argv[2], &good_to_bad) < 0 ||
+      good_to_bad == 0.0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
+      "invalid good-to-bad transition probability: ", (char *) cmd->argv[2],
+      NULL));
+  }
+
+  if (fault_parse_probability(cmd->argv[3], &bad_to_good) < 0 ||
+      bad_to_good == 0.0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
+      "invalid bad-to-good transition probability: ", (char *) cmd->argv[3],
+      NULL));
+  }
+
+  for (i = 4; i < cmd->argc; i++) {
+    const char *oper;
+    struct fault_rule *rule;
+
+    oper = cmd->argv[i];
+
+    if (supported_fsio_operation(oper) < 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
+        "unknown/unsupported ", category, " operation: ", oper, NULL));
+    }
+
+    rule = fault_get_rule(cmd, oper);
+    if (rule == NULL) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
+        "error configuring ", category, " burst for '", oper, "': ",
+        strerror(errno), NULL));
+    }
+
+    if (rule->good_to_bad > 0.0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, category,
+        " burst already configured for '", oper, "'", NULL));
+    }
+
+    rule->good_to_bad = good_to_bad;
+    rule->bad_to_good = bad_to_good;
+  }
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: FaultLog all|sample N|rate N[/s] */
+MODRET set_faultlog(cmd_rec *cmd) {
+  config_rec *c;
+  int mode;
+  unsigned long limit = 0;
+  const char *mode_text;
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 3) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  mode_text = cmd->argv[1];
+
+  if (strcasecmp(mode_text, "all") == 0) {
+    if (cmd->argc != 2) {
+      CONF_ERROR(cmd, "wrong number of parameters");
+    }
+
+    mode = FAULT_LOG_ALL;
+
+  } else if (strcasecmp(mode_text, "sample") == 0 ||
+             strcasecmp(mode_text, "rate") == 0) {
+    char *limit_text, *ptr = NULL;
+
+    if (cmd->argc != 3) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "missing ", mode_text,
+        " parameter", NULL));
+    }
+
+    mode = strcasecmp(mode_text, "sample") == 0 ? FAULT_LOG_SAMPLE :
+      FAULT_LOG_RATE;
+
+    limit_text = cmd->argv[2];
+    limit = strtoul(limit_text, &ptr, 10);
+    if (ptr == limit_text ||
+        limit == 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid ", mode_text, ": ",
+        limit_text, NULL));
+    }
+
+    if (*ptr != '\0') {
+      if (mode != FAULT_LOG_RATE ||
+          (strcasecmp(ptr, "/s") != 0 &&
+           strcasecmp(ptr, "/sec") != 0)) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid ", mode_text, ": ",
+          limit_text, NULL));
+      }
+    }
+
+  } else {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown FaultLog mode: ",
+      mode_text, NULL));
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = mode;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned long));
+  *((unsigned long *) c->argv[1]) = limit;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: FaultProfile on|off */
+MODRET set_faultprofile(cmd_rec *cmd) {
+  int profile;
+  config_rec *c;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  profile = get_boolean(cmd, 1);
+  if (profile == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = profile;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: FaultSlowOpThreshold delay [count] */
+MODRET set_faultslowopthreshold(cmd_rec *cmd) {
+  config_rec *c;
+  unsigned long threshold_usecs = 0;
+  unsigned int count = FAULT_SLOW_OP_DEFAULT_COUNT;
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 3) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (fault_parse_delay(cmd->argv[1], &threshold_usecs) < 0 ||
+      threshold_usecs == 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid threshold: ",
+      (char *) cmd->argv[1], NULL));
+  }
+
+  if (cmd->argc == 3) {
+    char *ptr = NULL;
+    long val;
+
+    val = strtol(cmd->argv[2], &ptr, 10);
+    if (ptr == cmd->argv[2] ||
+        *ptr != '\0' ||
+        val < 0 ||
+        val > 10000) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid count: ",
+        (char *) cmd->argv[2], NULL));
+    }
+
+    count = (unsigned int) val;
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(unsigned long));
+  *((unsigned long *) c->argv[0]) = threshold_usecs;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = count;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: FaultPageCache cache-size cold-latency [extent-size] */
+MODRET set_faultpagecache(cmd_rec *cmd) {
+  off_t cachesz = 0, extentsz = FAULT_PAGE_CACHE_DEFAULT_EXTENTSZ;
+  unsigned long cold_usecs = 0;
+
+  if (cmd->argc < 3 ||
+      cmd->argc > 4) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  if (fault_parse_size(cmd->argv[1], &cachesz) < 0 ||
+      cachesz == 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid cache size: ",
+      (char *) cmd->argv[1], NULL));
+  }
+
+  if (fault_parse_delay(cmd->argv[2], &cold_usecs) < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid cold latency: ",
+      (char *) cmd->argv[2], NULL));
+  }
+
+  if (cmd->argc == 4) {
+    if (fault_parse_size(cmd->argv[3], &extentsz) < 0 ||
+        extentsz == 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid extent size: ",
+        (char *) cmd->argv[3], NULL));
+    }
+  }
+
+  if (extentsz > cachesz) {
+    CONF_ERROR(cmd, "extent size cannot be larger than cache size");
+  }
+
+  /* The cache is shared by all sessions, and so is allocated now, in the
+   * daemon process.
+   */
+  fault_page_cache_unmap();
+  fault_page_cache = fault_page_cache_create(cachesz, extentsz, cold_usecs);
+  if (fault_page_cache == NULL) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
+      "unable to allocate shared memory for page cache: ", strerror(errno),
+      NULL));
+  }
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: FaultSeekModel latency-per-GB rotational-latency [max-seek-latency] */
+MODRET set_faultseekmodel(cmd_rec *cmd) {
+  config_rec *c;
+  unsigned long usecs_per_gb = 0, rotational_usecs = 0, max_seek_usecs = 0;
+
+  if (cmd->argc < 3 ||
+      cmd->argc > 4) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  if (fault_parse_delay(cmd->argv[1], &usecs_per_gb) < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid seek latency: ",
+      (char *) cmd->argv[1], NULL));
+  }
+
+  if (fault_parse_delay(cmd->argv[2], &rotational_usecs) < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid rotational latency: ",
+      (char *) cmd->argv[2], NULL));
+  }
+
+  if (cmd->argc == 4) {
+    if (fault_parse_delay(cmd->argv[3], &max_seek_usecs) < 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid maximum seek latency: ",
+        (char *) cmd->argv[3], NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(unsigned long));
+  *((unsigned long *) c->argv[0]) = usecs_per_gb;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned long));
+  *((unsigned long *) c->argv[1]) = rotational_usecs;
+  c->argv[2] = palloc(c->pool, sizeof(unsigned long));
+  *((unsigned long *) c->argv[2]) = max_seek_usecs;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: FaultVolume path baseline-iops burst-credits */
+MODRET set_faultvolume(cmd_rec *cmd) {
+  struct fault_volume *vol;
+  char *path, *ptr = NULL;
+  unsigned long baseline_iops, burst_credits;
+  void *addr;
+
+  CHECK_ARGS(cmd, 3);
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  path = cmd->argv[1];
+  if (*path != '/') {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "path '", path,
+      "' is not an absolute path", NULL));
+  }
+
+  baseline_iops = strtoul(cmd->argv[2], &ptr, 10);
+  if (ptr == cmd->argv[2] ||
+      *ptr != '\0' ||
+      baseline_iops == 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid baseline IOPS: ",
+      (char *) cmd->argv[2], NULL));
+  }
+
+  ptr = NULL;
+  burst_credits = strtoul(cmd->argv[3], &ptr, 10);
+  if (ptr == cmd->argv[3] ||
+      *ptr != '\0') {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid burst credits: ",
+      (char *) cmd->argv[3], NULL));
+  }
+
+  addr = mmap(NULL, sizeof(struct fault_volume_bucket),
+    PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if (addr == MAP_FAILED) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
+      "unable to allocate shared memory for volume: ", strerror(errno), NULL));
+  }
+
+  vol = pcalloc(fault_pool, sizeof(struct fault_volume));
+
+  /* Ignore any trailing slashes. */
+  vol->path = pstrdup(fault_pool, path);
+  vol->pathlen = strlen(vol->path);
+  while (vol->pathlen > 1 &&
+         vol->path[vol->pathlen-1] == '/') {
+    vol->pathlen--;
+  }
+
+  vol->baseline_iops = baseline_iops;
+  vol->burst_credits = (double) burst_credits;
+
+  /* Volumes start with a full bucket of burst credits. */
+  vol->bucket = addr;
+  memset(vol->bucket, 0, sizeof(struct fault_volume_bucket));
+  vol->bucket->credits = vol->burst_credits;
+  vol->bucket->refill_usecs = fault_now_usecs();
+
+  if (fault_volumes == NULL) {
+    fault_volumes = make_array(fault_pool, 1, sizeof(struct fault_volume *));
+  }
+
+  *((struct fault_volume **) push_array(fault_volumes)) = vol;
+  return PR_HANDLED(cmd);
+}
+
+/* usage: FaultWriteBack flush-bandwidth [max-dirty] */
+MODRET set_faultwriteback(cmd_rec *cmd) {
+  config_rec *c;
+  off_t flush_bps = 0, max_dirty = 0;
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 3) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  if (fault_parse_rate(cmd->tmp_pool, cmd->argv[1], &flush_bps) < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid flush bandwidth: ",
+      (char *) cmd->argv[1], NULL));
+  }
+
+  if (cmd->argc == 3) {
+    if (fault_parse_size(cmd->argv[2], &max_dirty) < 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid maximum dirty size: ",
+        (char *) cmd->argv[2], NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(off_t));
+  *((off_t *) c->argv[0]) = flush_bps;
+  c->argv[1] = palloc(c->pool, sizeof(off_t));
+  *((off_t *) c->argv[1]) = max_dirty;
+
+  return PR_HANDLED(cmd);
+}
+
+/* Command handlers
+ */
+
+MODRET fault_post_pass(cmd_rec *cmd) {
+  if (fault_engine == FALSE) {
+    return PR_DECLINED(cmd);
+  }
+
+  /* Now that we know the user's <Anonymous> context and chroot, if any,
+   * recompile the rules in effect for this session.
+   */
+  fault_compile_rules();
+
+  if (pr_trace_get_level(trace_channel) >= 20) {
+    pr_trace_msg(trace_channel, 20,
+      "recompiled %u fault rules after login", fault_sess_rules->nelts);
+    fault_rules_dump();
+  }
+
+  return PR_DECLINED(cmd);
+}
+
+static int fault_command_delay_matches(const struct fault_command_delay *delay,
+    cmd_rec *cmd) {
+  register unsigned int i;
+  char **commands;
+  int matched = FALSE;
+
+  commands = delay->commands->elts;
+  for (i = 0; i < delay->commands->nelts; i++) {
+    if (strcasecmp(commands[i], cmd->argv[0]) == 0 ||
+        strcasecmp(commands[i], "ALL") == 0) {
+      matched = TRUE;
+      break;
+    }
+  }
+
+  if (matched == FALSE) {
+    return FALSE;
+  }
+
+  if (delay->user != NULL &&
+      (session.user == NULL ||
+       strcmp(delay->user, session.user) != 0)) {
+    return FALSE;
+  }
+
+  if (delay->class_name != NULL &&
+      (session.conn_class == NULL ||
+       strcmp(delay->class_name, session.conn_class->cls_name) != 0)) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static struct fault_command_delay *fault_find_command_delay(xaset_t *set,
+    cmd_rec *cmd) {
+  config_rec *c;
+
+  c = find_config(set, CONF_PARAM, "FaultCommandDelay", FALSE);
+  while (c != NULL) {
+    struct fault_command_delay *delay;
+
+    pr_signals_handle();
+
+    delay = c->argv[0];
+    if (fault_command_delay_matches(delay, cmd) == TRUE) {
+      return delay;
+    }
+
+    c = find_config_next(c, c->next, CONF_PARAM, "FaultCommandDelay", FALSE);
+  }
+
+  return NULL;
+}
+
+static void fault_set_note(const char *key, const char *value) {
+  (void) pr_table_remove(session.notes, key, NULL);
+
+  if (pr_table_add_dup(session.notes, key, value, 0) < 0) {
+    pr_trace_msg(trace_channel, 3, "error setting '%s' note: %s", key,
+      strerror(errno));
+  }
+}
+
+/* Delays any commands, FTP or SFTP, for which a command delay is configured;
+ * the first matching delay, from the <Anonymous> context (if any) then from
+ * the server, applies.
+ */
+MODRET fault_pre_cmd(cmd_rec *cmd) {
+  struct fault_command_delay *delay = NULL;
+
+  if (fault_engine == FALSE) {
+    return PR_DECLINED(cmd);
+  }
+
+  if (fault_slow_op_usecs > 0) {
+    fault_op_set_cmd(cmd->argv[0]);
+  }
+
+  memset(&fault_cmd_stats, 0, sizeof(fault_cmd_stats));
+
+  if (fault_profile == TRUE) {
+    fault_cmd_time = fault_get_cmd_time(cmd->argv[0]);
+    fault_cmd_start_usecs = fault_now_usecs();
+  }
+
+  if (fault_have_command_delays == FALSE) {
+    return PR_DECLINED(cmd);
+  }
+
+  if (session.anon_config != NULL) {
+    delay = fault_find_command_delay(session.anon_config->subset, cmd);
+  }
+
+  if (delay == NULL) {
+    delay = fault_find_command_delay(main_server->conf, cmd);
+  }
+
+  if (delay == NULL) {
+    return PR_DECLINED(cmd);
+  }
+
+  delay->delayed++;
+  if (delay->delay_usecs != FAULT_DELAY_FOREVER) {
+    delay->delayed_usecs += delay->delay_usecs;
+  }
+
+  pr_trace_msg(trace_channel, 15, "command: %s, delaying %lu usecs",
+    (char *) cmd->argv[0], delay->delay_usecs);
+  fault_event_generate(FAULT_EVENT_DELAY_INJECTED, "command", cmd->argv[0],
+    NULL, 0, delay->delay_usecs, "rule");
+  fault_delay(delay->delay_usecs);
+
+  return PR_DECLINED(cmd);
+}
+
+/* Publishes the command's counters as notes, for e.g. ExtendedLog.  This is
+ * done in the POST_CMD phase, rather than LOG_CMD, so that the notes are set
+ * regardless of which module's LOG_CMD handlers run first.
+ */
+MODRET fault_post_cmd(cmd_rec *cmd) {
+  char buf[32];
+
+  if (fault_engine == FALSE) {
+    return PR_DECLINED(cmd);
+  }
+
+  fault_op_cmd = "none";
+
+  pr_snprintf(buf, sizeof(buf), "%lu", fault_cmd_stats.faults);
+  fault_set_note("mod_fault.faults", buf);
+  pr_snprintf(buf, sizeof(buf), "%lu",
+    (unsigned long) (fault_cmd_stats.delay_usecs / 1000));
+  fault_set_note("mod_fault.delay-ms", buf);
+
+  /* The filesystem time is only measured when profiling. */
+  if (fault_cmd_time == NULL) {
+    return PR_DECLINED(cmd);
+  }
+
+  fault_cmd_time->count++;
+  fault_cmd_time->total_usecs += (fault_now_usecs() - fault_cmd_start_usecs);
+  fault_cmd_time = NULL;
+
+  pr_snprintf(buf, sizeof(buf), "%lu",
+    (unsigned long) (fault_cmd_stats.fsio_usecs / 1000));
+  fault_set_note("mod_fault.fs-ms", buf);
+
+  return PR_DECLINED(cmd);
+}
+
+MODRET fault_pre_retr(cmd_rec *cmd) {
+  if (fault_engine == FALSE) {
+    return PR_DECLINED(cmd);
+  }
+
+  fault_retr.active = TRUE;
+  fault_retr.checked = FALSE;
+  fault_retr.reads = 0;
+  fault_retr.delay_usecs = 0;
+  fault_retr.start_usecs = fault_now_usecs();
+
+  if (fault_retr_uses_sendfile() == TRUE) {
+    const struct fault_rule_error *err = NULL;
+    const char *path;
+    struct stat st;
+    off_t nbytes;
+
+    path = dir_best_path(cmd->tmp_pool,
+      pr_fs_decode_path(cmd->tmp_pool, cmd->arg));
+    if (path == NULL ||
+        pr_fsio_stat(path, &st) < 0 ||
+        !S_ISREG(st.st_mode)) {
+      /* Let mod_xfer report the problem. */
+      return PR_DECLINED(cmd);
+    }
+
+    nbytes = st.st_size - session.restart_pos;
+    if (nbytes <= 0) {
+      return PR_DECLINED(cmd);
+    }
+
+    fault_retr.checked = TRUE;
+    if (fault_sendfile_check(NULL, path, nbytes, &err) == 0) {
+      int xerrno = err->xerrno;
+
+      if (fault_log_fault() == TRUE) {
+        pr_trace_msg(trace_channel, 4,
+          "fsio: sendfile '%s', returning %s (%s)", path, err->name,
+          err->text);
+      }
+
+      fault_retr.active = FALSE;
+
+      pr_response_add_err(R_451, "%s: %s", cmd->arg, strerror(xerrno));
+      pr_cmd_set_errno(cmd, xerrno);
+      errno = xerrno;
+      return PR_ERROR(cmd);
+    }
+  }
+
+  return PR_DECLINED(cmd);
+}
+
+MODRET fault_post_retr(cmd_rec *cmd) {
+  fault_retr.active = FALSE;
+  return PR_DECLINED(cmd);
+}
+
+MODRET fault_pre_xfer(cmd_rec *cmd) {
+  if (fault_profile == FALSE) {
+    return PR_DECLINED(cmd);
+  }
+
+  memset(fault_cmd_profile, 0, sizeof(fault_cmd_profile));
+
+  fault_xfer.active = TRUE;
+  fault_xfer.netio_seen = FALSE;
+  fault_xfer.start_usecs = fault_now_usecs();
+  fault_xfer.fsio_usecs = fault_xfer.netio_usecs = 0;
+
+  return PR_DECLINED(cmd);
+}
+
+/* Notes, and logs, whether the transfer spent more of its time blocked on
+ * storage, or on the network; the remainder is e.g. the data connection
+ * setup.  These notes can be logged using e.g.
+ * "%{note:mod_fault.xfer-bound}" in a LogFormat.
+ */
+static void fault_xfer_done(cmd_rec *cmd) {
+  uint64_t total_usecs;
+  unsigned long storage_ms, network_ms;
+  const char *bound;
+  char buf[32];
+
+  fault_xfer.active = FALSE;
+
+  total_usecs = fault_now_usecs() - fault_xfer.start_usecs;
+  storage_ms = (unsigned long) (fault_xfer.fsio_usecs / 1000);
+
+  pr_snprintf(buf, sizeof(buf), "%lu", storage_ms);
+  fault_set_note("mod_fault.xfer-storage-ms", buf);
+
+  if (fault_xfer.netio_seen == FALSE) {
+    pr_trace_msg(trace_channel, 5,
+      "profile: %s: %lu ms total, %lu ms storage, network time unknown",
+      (char *) cmd->argv[0], (unsigned long) (total_usecs / 1000),
+      storage_ms);
+
+    (void) pr_table_remove(session.notes, "mod_fault.xfer-network-ms", NULL);
+    fault_set_note("mod_fault.xfer-bound", "unknown");
+    return;
+  }
+
+  network_ms = (unsigned long) (fault_xfer.netio_usecs / 1000);
+  bound = fault_xfer.fsio_usecs >= fault_xfer.netio_usecs ? "storage" :
+    "network";
+
+  pr_trace_msg(trace_channel, 5,
+    "profile: %s: %lu ms total, %lu ms storage, %lu ms network, %s-bound",
+    (char *) cmd->argv[0], (unsigned long) (total_usecs / 1000), storage_ms,
+    network_ms, bound);
+
+  pr_snprintf(buf, sizeof(buf), "%lu", network_ms);
+  fault_set_note("mod_fault.xfer-network-ms", buf);
+  fault_set_note("mod_fault.xfer-bound", bound);
+}
+
+MODRET fault_post_xfer(cmd_rec *cmd) {
+  if (fault_profile == FALSE) {
+    return PR_DECLINED(cmd);
+  }
+
+  fault_profile_log(cmd->argv[0], FAULT_XFER_READ,
+    &(fault_cmd_profile[FAULT_XFER_READ]));
+  fault_profile_log(cmd->argv[0], FAULT_XFER_WRITE,
+    &(fault_cmd_profile[FAULT_XFER_WRITE]));
+  fault_xfer_done(cmd);
+
+  return PR_DECLINED(cmd);
+}
+
+/* NetIO handlers
+ */
+
+/* Evaluates the netio rules for the stream, applying any stall.  Returns 0
+ * if an error is to be injected, -1 otherwise.
+ */
+static int fault_netio_check(pr_netio_stream_t *nstrm,
+    const struct fault_rule_error **err) {
+  register unsigned int i;
+  struct fault_netio_rule **nrules;
+  struct fault_netio_stream *strm;
+  uint64_t now = 0;
+
+  if (fault_netio_rules == NULL) {
+    return -1;
+  }
+
+  strm = &(fault_netio_streams[nstrm->strm_type == PR_NETIO_STRM_CTRL ?
+    FAULT_NETIO_CTRL : FAULT_NETIO_DATA]);
+
+  nrules = fault_netio_rules->elts;
+  for (i = 0; i < fault_netio_rules->nelts; i++) {
+    struct fault_netio_rule *nrule;
+    struct fault_rule *rule;
+
+    nrule = nrules[i];
+    rule = &(nrule->rule);
+
+    if (nrule->strm_type != nstrm->strm_type) {
+      continue;
+    }
+
+    if (nrule->burst_left > 0) {
+      nrule->burst_left--;
+      rule->calls++;
+      rule->faults++;
+
+      *err = fault_rule_pick_error(rule);
+      fault_event_generate(FAULT_EVENT_FAULT_INJECTED, "netio", rule->oper,
+        NULL, (*err)->xerrno, 0, "rule");
+      return 0;
+    }
+
+    if (
+        nrule->stalled == TRUE ||
+        strm->bytes < nrule->after_bytes) {
+      continue;
+    }
+
+    if (rule->max_faults > 0 &&
+        rule->faults >= rule->max_faults) {
+      continue;
+    }
+
+    if (nrule->after_usecs > 0) {
+      if (now == 0) {
+        now = fault_now_usecs();
+      }
+
+      if (now - strm->start_usecs < nrule->after_usecs) {
+        continue;
+      }
+    }
 
-static int fault_fsio_fchown(pr_fh_t *fh, int fd, uid_t uid, gid_t gid) {
-  int xerrno = 0;
+    rule->calls++;
 
-  if (fault_get_errno(fault_fsio_errtab, "chown", &xerrno) < 0) {
-    return fchown(fd, uid, gid);
-  }
+    if (rule->error_prob[FAULT_STATE_GOOD] < 1.0 &&
+        fault_random() >= rule->error_prob[FAULT_STATE_GOOD]) {
+      continue;
+    }
 
-  pr_trace_msg(trace_channel, 4, "fsio: fchown %d ('%s'), returning %s (%s)",
-    fd, fh->fh_path, fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
-}
+    rule->faults++;
 
-static int fault_fsio_futimes(pr_fh_t *fh, int fd, struct timeval *tvs) {
-  int xerrno = 0;
+    if (rule->nerrors == 0) {
+      /* Stall this stream, once. */
+      nrule->stalled = TRUE;
 
-  if (fault_get_errno(fault_fsio_errtab, "utimes", &xerrno) < 0) {
-#if defined(HAVE_FUTIMES)
-    int res;
+      pr_trace_msg(trace_channel, 8,
+        "netio: stalling %s stream after %" PR_LU " bytes for %lu usecs",
+        rule->oper, (pr_off_t) strm->bytes, rule->delay_usecs[0]);
+      fault_event_generate(FAULT_EVENT_DELAY_INJECTED, "netio", rule->oper,
+        NULL, 0, rule->delay_usecs[0], "rule");
+      fault_delay(rule->delay_usecs[0]);
+      continue;
+    }
 
-    res = futimes(fd, tvs);
-    if (res < 0 &&
-        errno == ENOSYS) {
-      return utimes(fh->fh_path, tvs);
+    if (nrule->burst > 1) {
+      nrule->burst_left = nrule->burst - 1;
     }
 
-    return res;
-#else
-    return utimes(fh->fh_path, tvs);
-#endif /* HAVE_FUTIMES */
+    *err = fault_rule_pick_error(rule);
+    fault_event_generate(FAULT_EVENT_FAULT_INJECTED, "netio", rule->oper,
+      NULL, (*err)->xerrno, 0, "rule");
+    return 0;
   }
 
-  pr_trace_msg(trace_channel, 4, "fsio: futimes (%d) '%s', returning %s (%s)",
-    fd, fh->fh_path, fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
   return -1;
 }
 
-static int fault_fsio_lchown(pr_fs_t *fs, const char *path, uid_t uid,
-    gid_t gid) {
-  int xerrno = 0;
-
-  if (fault_get_errno(fault_fsio_errtab, "chown", &xerrno) < 0) {
-    return lchown(path, uid, gid);
+static pr_netio_stream_t *fault_netio_open(pr_netio_stream_t *nstrm, int fd,
+    int mode) {
+  register unsigned int i;
+  struct fault_netio_rule **nrules;
+
+  if (nstrm->strm_type == PR_NETIO_STRM_CTRL ||
+      nstrm->strm_type == PR_NETIO_STRM_DATA) {
+    struct fault_netio_stream *strm;
+
+    strm = &(fault_netio_streams[nstrm->strm_type == PR_NETIO_STRM_CTRL ?
+      FAULT_NETIO_CTRL : FAULT_NETIO_DATA]);
+    strm->bytes = 0;
+    strm->start_usecs = fault_now_usecs();
+    strm->calls = strm->fragments = strm->retries = 0;
+    (void) getrusage(RUSAGE_SELF, &(strm->start_rusage));
+
+    if (fault_netio_rules != NULL) {
+      nrules = fault_netio_rules->elts;
+      for (i = 0; i < fault_netio_rules->nelts; i++) {
+        if (nrules[i]->strm_type == nstrm->strm_type) {
+          nrules[i]->stalled = FALSE;
+          nrules[i]->burst_left = 0;
+        }
+      }
+    }
   }
 
-  pr_trace_msg(trace_channel, 4, "fsio: lchown '%s', returning %s (%s)", path,
-    fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
+  return (fault_netio_open_cb)(nstrm, fd, mode);
 }
 
-static off_t fault_fsio_lseek(pr_fh_t *fh, int fd, off_t offset, int whence) {
-  int xerrno = 0;
+static uint64_t fault_rusage_usecs(const struct rusage *ru) {
+  return ((uint64_t) ru->ru_utime.tv_sec * 1000000) + ru->ru_utime.tv_usec +
+    ((uint64_t) ru->ru_stime.tv_sec * 1000000) + ru->ru_stime.tv_usec;
+}
 
-  if (fault_get_errno(fault_fsio_errtab, "lseek", &xerrno) < 0) {
-    return lseek(fd, offset, whence);
+/* For data streams, notes how much CPU the transfer took, to compare the
+ * cost of absorbing fragmented or failed reads/writes.
+ */
+static int fault_netio_close(pr_netio_stream_t *nstrm) {
+  if (nstrm->strm_type == PR_NETIO_STRM_DATA) {
+    struct fault_netio_stream *strm;
+    struct rusage ru;
+    uint64_t cpu_usecs;
+
+    strm = &(fault_netio_streams[FAULT_NETIO_DATA]);
+
+    (void) getrusage(RUSAGE_SELF, &ru);
+    cpu_usecs = fault_rusage_usecs(&ru) -
+      fault_rusage_usecs(&(strm->start_rusage));
+    strm->total_cpu_usecs += cpu_usecs;
+
+    pr_trace_msg(trace_channel, 9,
+      "netio: data stream closed: %" PR_LU " bytes, %lu calls (%lu "
+      "fragmented, %lu retryable errors), %lu usecs CPU",
+      (pr_off_t) strm->bytes, strm->calls, strm->fragments, strm->retries,
+      (unsigned long) cpu_usecs);
   }
 
-  pr_trace_msg(trace_channel, 4, "fsio: lseek %d ('%s'), returning %s (%s)", fd,
-    fh->fh_path, fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
+  return (fault_netio_close_cb)(nstrm);
 }
 
-static int fault_fsio_mkdir(pr_fs_t *fs, const char *path, mode_t mode) {
-  int xerrno = 0;
-
-  if (fault_get_errno(fault_fsio_errtab, "mkdir", &xerrno) < 0) {
-    return mkdir(path, mode);
+static int fault_netio_io(pr_netio_stream_t *nstrm, char *buf, size_t buflen,
+    int (*io_cb)(pr_netio_stream_t *, char *, size_t), int dir) {
+  const struct fault_rule_error *err = NULL;
+  struct fault_netio_stream *strm;
+  size_t max_io;
+  uint64_t start_usecs = 0;
+  int idx, res;
+
+  if (nstrm->strm_type != PR_NETIO_STRM_CTRL &&
+      nstrm->strm_type != PR_NETIO_STRM_DATA) {
+    return (io_cb)(nstrm, buf, buflen);
   }
 
-  pr_trace_msg(trace_channel, 4, "fsio: mkdir '%s', returning %s (%s)", path,
-    fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
-}
+  idx = nstrm->strm_type == PR_NETIO_STRM_CTRL ? FAULT_NETIO_CTRL :
+    FAULT_NETIO_DATA;
+  strm = &(fault_netio_streams[idx]);
 
-static void *fault_fsio_opendir(pr_fs_t *fs, const char *path) {
-  int xerrno = 0;
+  strm->calls++;
+  strm->total_calls++;
 
-  if (fault_get_errno(fault_fsio_errtab, "opendir", &xerrno) < 0) {
-    return opendir(path);
+  if (fault_xfer.active == TRUE &&
+      idx == FAULT_NETIO_DATA) {
+    fault_xfer.netio_seen = TRUE;
+    start_usecs = fault_now_usecs();
   }
 
-  pr_trace_msg(trace_channel, 4, "fsio: opendir '%s', returning %s (%s)", path,
-    fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return NULL;
-}
+  if (fault_netio_check(nstrm, &err) == 0) {
+    if (fault_log_fault() == TRUE) {
+      pr_trace_msg(trace_channel, 4,
+        "netio: %s %s stream, returning %s (%s)",
+        dir == FAULT_XFER_READ ? "read" : "write",
+        idx == FAULT_NETIO_CTRL ? "ctrl" : "data", err->name, err->text);
+    }
 
-static ssize_t fault_fsio_pread(pr_fh_t *fh, int fd, void *buf, size_t bufsz,
-    off_t offset) {
-  int xerrno = 0;
+    if (err->xerrno == EAGAIN ||
+        err->xerrno == EINTR) {
+      strm->retries++;
+      strm->total_retries++;
+    }
 
-  /* For fault injection purposes, we treat `pread(2)` just like `read(2)`. */
-  if (fault_get_errno(fault_fsio_errtab, "read", &xerrno) < 0) {
-#if defined(HAVE_PREAD)
-    return pread(fd, buf, bufsz, offset);
-#else
-    errno = ENOSYS;
+    if (start_usecs > 0) {
+      fault_xfer.netio_usecs += (fault_now_usecs() - start_usecs);
+    }
+
+    fault_cmd_stats.faults++;
+    nstrm->strm_errno = err->xerrno;
+    errno = err->xerrno;
     return -1;
-#endif /* HAVE_PREAD */
   }
 
-  pr_trace_msg(trace_channel, 4,
-    "fsio: pread %d ('%s', %lu bytes, %" PR_LU " offset), returning %s (%s)",
-    fd, fh->fh_path, (unsigned long) bufsz, (pr_off_t) offset,
-    fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
-}
+  max_io = fault_netio_max_io[idx][dir];
+  if (max_io > 0 &&
+      buflen > max_io) {
+    buflen = max_io;
+    strm->fragments++;
+    strm->total_fragments++;
+  }
 
-static ssize_t fault_fsio_pwrite(pr_fh_t *fh, int fd, const void *buf,
-    size_t bufsz, off_t offset) {
-  int xerrno = 0;
+  res = (io_cb)(nstrm, buf, buflen);
+  if (res > 0) {
+    strm->bytes += res;
+  }
 
-  /* For fault injection purposes, we treat `pwrite(2)` just like `write(2)`. */
-  if (fault_get_errno(fault_fsio_errtab, "write", &xerrno) < 0) {
-#if defined(HAVE_PWRITE)
-    return pwrite(fd, buf, bufsz, offset);
-#else
-    errno = ENOSYS;
-    return -1;
-#endif /* HAVE_PWRITE */
+  if (start_usecs > 0) {
+    fault_xfer.netio_usecs += (fault_now_usecs() - start_usecs);
   }
 
-  pr_trace_msg(trace_channel, 4,
-    "fsio: pwrite %d ('%s', %lu bytes, %" PR_LU " offset), returning %s (%s)",
-    fd, fh->fh_path, (unsigned long) bufsz, (pr_off_t) offset,
-    fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
+  return res;
 }
 
-static int fault_fsio_read(pr_fh_t *fh, int fd, char *buf, size_t bufsz) {
-  int xerrno = 0;
-
-  if (fault_get_errno(fault_fsio_errtab, "read", &xerrno) < 0) {
-    return read(fd, buf, bufsz);
-  }
+static int fault_netio_read(pr_netio_stream_t *nstrm, char *buf,
+    size_t buflen) {
+  return fault_netio_io(nstrm, buf, buflen, fault_netio_read_cb,
+    FAULT_XFER_READ);
+}
 
-  pr_trace_msg(trace_channel, 4,
-    "fsio: read %d ('%s', %lu bytes), returning %s (%s)", fd, fh->fh_path,
-    (unsigned long) bufsz, fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
+static int fault_netio_write(pr_netio_stream_t *nstrm, char *buf,
+    size_t buflen) {
+  return fault_netio_io(nstrm, buf, buflen, fault_netio_write_cb,
+    FAULT_XFER_WRITE);
 }
 
-static struct dirent *fault_fsio_readdir(pr_fs_t *fs, void *dirh) {
-  int xerrno = 0;
+/* Registers our NetIO for the streams with rules, unless another module
+ * (e.g. mod_tls) already handles them.
+ */
+static void fault_netio_register(void) {
+  int strm_types = 0;
 
-  if (fault_get_errno(fault_fsio_errtab, "readdir", &xerrno) < 0) {
-    return readdir((DIR *) dirh);
+  if (fault_netio_rules != NULL) {
+    register unsigned int i;
+    struct fault_netio_rule **nrules;
+
+    nrules = fault_netio_rules->elts;
+    for (i = 0; i < fault_netio_rules->nelts; i++) {
+      strm_types |= nrules[i]->strm_type;
+    }
   }
 
-  pr_trace_msg(trace_channel, 4, "fsio: readdir, returning %s (%s)",
-    fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return NULL;
-}
+  if (fault_netio_max_io[FAULT_NETIO_CTRL][FAULT_XFER_READ] > 0 ||
+      fault_netio_max_io[FAULT_NETIO_CTRL][FAULT_XFER_WRITE] > 0) {
+    strm_types |= PR_NETIO_STRM_CTRL;
+  }
 
-static int fault_fsio_readlink(pr_fs_t *fs, const char *path, char *buf,
-    size_t bufsz) {
-  int xerrno = 0;
+  /* Profiling times the data connection's reads and writes. */
+  if (fault_netio_max_io[FAULT_NETIO_DATA][FAULT_XFER_READ] > 0 ||
+      fault_netio_max_io[FAULT_NETIO_DATA][FAULT_XFER_WRITE] > 0 ||
+      fault_profile == TRUE) {
+    strm_types |= PR_NETIO_STRM_DATA;
+  }
 
-  if (fault_get_errno(fault_fsio_errtab, "readlink", &xerrno) < 0) {
-    return readlink(path, buf, bufsz);
+  if (strm_types == 0) {
+    return;
   }
 
-  pr_trace_msg(trace_channel, 4, "fsio: readlink '%s', returning %s (%s)", path,
-    fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
-}
+  if ((strm_types & PR_NETIO_STRM_CTRL) &&
+      pr_get_netio(PR_NETIO_STRM_CTRL) != NULL) {
+    pr_trace_msg(trace_channel, 3,
+      "ctrl NetIO already registered by another module, ignoring ctrl "
+      "netio faults");
+    strm_types &= ~PR_NETIO_STRM_CTRL;
+  }
 
-static int fault_fsio_rename(pr_fs_t *fs, const char *src_path,
-    const char *dst_path) {
-  int xerrno = 0;
+  if ((strm_types & PR_NETIO_STRM_DATA) &&
+      pr_get_netio(PR_NETIO_STRM_DATA) != NULL) {
+    pr_trace_msg(trace_channel, 3,
+      "data NetIO already registered by another module, ignoring data "
+      "netio faults");
+    strm_types &= ~PR_NETIO_STRM_DATA;
+  }
 
-  if (fault_get_errno(fault_fsio_errtab, "rename", &xerrno) < 0) {
-    return rename(src_path, dst_path);
+  if (strm_types == 0) {
+    return;
   }
 
-  pr_trace_msg(trace_channel, 4, "fsio: rename '%s' to '%s', returning %s (%s)",
-    src_path, dst_path, fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
+  fault_netio = pr_alloc_netio2(session.pool, &fault_module, "fault");
+  fault_netio_open_cb = fault_netio->open;
+  fault_netio_close_cb = fault_netio->close;
+  fault_netio_read_cb = fault_netio->read;
+  fault_netio_write_cb = fault_netio->write;
+
+  fault_netio->open = fault_netio_open;
+  fault_netio->close = fault_netio_close;
+  fault_netio->read = fault_netio_read;
+  fault_netio->write = fault_netio_write;
+
+  /* The control connection is already open. */
+  fault_netio_streams[FAULT_NETIO_CTRL].start_usecs = fault_now_usecs();
+  (void) getrusage(RUSAGE_SELF,
+    &(fault_netio_streams[FAULT_NETIO_CTRL].start_rusage));
+
+  if (pr_register_netio(fault_netio, strm_types) < 0) {
+    pr_trace_msg(trace_channel, 1, "error registering fault NetIO: %s",
+      strerror(errno));
+    fault_netio = NULL;
+  }
 }
 
-static int fault_fsio_rmdir(pr_fs_t *fs, const char *path) {
-  int xerrno = 0;
+/* Authentication handlers
+ */
+
+/* Delays the lookup, then declines, so that the real auth modules handle
+ * it.
+ */
+MODRET fault_auth_delay(cmd_rec *cmd, int idx) {
+  unsigned long delay_usecs;
+
+  if (fault_engine == FALSE) {
+    return PR_DECLINED(cmd);
+  }
 
-  if (fault_get_errno(fault_fsio_errtab, "rmdir", &xerrno) < 0) {
-    return rmdir(path);
+  delay_usecs = fault_auth_delay_usecs[idx];
+  if (delay_usecs == 0) {
+    return PR_DECLINED(cmd);
   }
 
-  pr_trace_msg(trace_channel, 4, "fsio: rmdir '%s', returning %s (%s)", path,
-    fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
+  fault_auth_delayed[idx]++;
+
+  pr_trace_msg(trace_channel, 15, "auth: %s, delaying %lu usecs",
+    fault_auth_operations[idx], delay_usecs);
+  fault_event_generate(FAULT_EVENT_DELAY_INJECTED, "auth",
+    fault_auth_operations[idx], NULL, 0, delay_usecs, "rule");
+  fault_delay(delay_usecs);
+
+  return PR_DECLINED(cmd);
 }
 
-static int fault_fsio_write(pr_fh_t *fh, int fd, const char *buf,
-    size_t bufsz) {
-  int xerrno = 0;
+MODRET fault_auth_auth(cmd_rec *cmd) {
+  return fault_auth_delay(cmd, 0);
+}
 
-  if (fault_get_errno(fault_fsio_errtab, "write", &xerrno) < 0) {
-    return write(fd, buf, bufsz);
-  }
+MODRET fault_auth_check(cmd_rec *cmd) {
+  return fault_auth_delay(cmd, 1);
+}
 
-  pr_trace_msg(trace_channel, 4,
-    "fsio: write %d ('%s', %lu bytes), returning %s (%s)", fd, fh->fh_path,
-    (unsigned long) bufsz, fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
+MODRET fault_auth_getgrgid(cmd_rec *cmd) {
+  return fault_auth_delay(cmd, 2);
 }
 
-static int fault_fsio_unlink(pr_fs_t *fs, const char *path) {
-  int xerrno = 0;
+MODRET fault_auth_getgrnam(cmd_rec *cmd) {
+  return fault_auth_delay(cmd, 3);
+}
 
-  if (fault_get_errno(fault_fsio_errtab, "unlink", &xerrno) < 0) {
-    return unlink(path);
-  }
+MODRET fault_auth_getgroups(cmd_rec *cmd) {
+  return fault_auth_delay(cmd, 4);
+}
 
-  pr_trace_msg(trace_channel, 4, "fsio: unlink '%s', returning %s (%s)", path,
-    fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
+MODRET fault_auth_getpwnam(cmd_rec *cmd) {
+  return fault_auth_delay(cmd, 5);
 }
 
-static int fault_fsio_utimes(pr_fs_t *fs, const char *path,
-    struct timeval *tvs) {
-  int xerrno = 0;
+MODRET fault_auth_getpwuid(cmd_rec *cmd) {
+  return fault_auth_delay(cmd, 6);
+}
 
-  if (fault_get_errno(fault_fsio_errtab, "utimes", &xerrno) < 0) {
-    return utimes(path, tvs);
-  }
+MODRET fault_auth_gid2name(cmd_rec *cmd) {
+  return fault_auth_delay(cmd, 7);
+}
 
-  pr_trace_msg(trace_channel, 4, "fsio: utimes '%s', returning %s (%s)", path,
-    fault_errno2text(xerrno), strerror(xerrno));
-  errno = xerrno;
-  return -1;
+MODRET fault_auth_name2gid(cmd_rec *cmd) {
+  return fault_auth_delay(cmd, 8);
 }
 
-/* Configuration handlers
+MODRET fault_auth_name2uid(cmd_rec *cmd) {
+  return fault_auth_delay(cmd, 9);
+}
+
+MODRET fault_auth_uid2name(cmd_rec *cmd) {
+  return fault_auth_delay(cmd, 10);
+}
+
+/* Event handlers
  */
 
-/* usage: FaultEngine on|off */
-MODRET set_faultengine(cmd_rec *cmd) {
-  int engine = -1;
+static void fault_exit_ev(const void *event_data, void *user_data) {
+  register unsigned int i;
   config_rec *c;
 
-  CHECK_ARGS(cmd, 1);
-  CHECK_CONF(cmd, CONF_ROOT);
+  fault_rules_summary();
 
-  engine = get_boolean(cmd, 1);
-  if (engine == -1) {
-    CONF_ERROR(cmd, "expected Boolean parameter");
-  }
+  if (fault_netio_rules != NULL) {
+    struct fault_netio_rule **nrules;
 
-  c = add_config_param(cmd->argv[0], 1, NULL);
-  c->argv[0] = pcalloc(c->pool, sizeof(int));
-  *((int *) c->argv[0]) = engine;
+    nrules = fault_netio_rules->elts;
+    for (i = 0; i < fault_netio_rules->nelts; i++) {
+      const struct fault_rule *rule;
 
-  return PR_HANDLED(cmd);
-}
+      rule = &(nrules[i]->rule);
+      if (rule->calls > 0) {
+        pr_trace_msg(trace_channel, 5,
+          "netio rule '%s': %lu calls, %u faults", rule->oper, rule->calls,
+          rule->faults);
+      }
+    }
+  }
 
-/* usage: FaultInject category error oper1 ... */
-MODRET set_faultinject(cmd_rec *cmd) {
-  register unsigned int i;
-  const char *error_category, *error_text;
-  int xerrno;
+  if (fault_netio != NULL) {
+    for (i = 0; i < 2; i++) {
+      const struct fault_netio_stream *strm;
+
+      strm = &(fault_netio_streams[i]);
+      if (strm->total_fragments == 0 &&
+          strm->total_retries == 0) {
+        continue;
+      }
+
+      pr_trace_msg(trace_channel, 5,
+        "netio %s: %lu calls, %lu fragmented, %lu retryable errors "
+        "(%lu extra calls), %lu usecs CPU in closed streams",
+        i == FAULT_NETIO_CTRL ? "ctrl" : "data", strm->total_calls,
+        strm->total_fragments, strm->total_retries,
+        strm->total_fragments + strm->total_retries,
+        (unsigned long) strm->total_cpu_usecs);
+    }
+  }
 
-  if (cmd->argc < 4) {
-    CONF_ERROR(cmd, "missing parameters");
+  if (fault_profile == TRUE) {
+    fault_cmd_times_log();
+    fault_profile_log("session", FAULT_XFER_READ,
+      &(fault_sess_profile[FAULT_XFER_READ]));
+    fault_profile_log("session", FAULT_XFER_WRITE,
+      &(fault_sess_profile[FAULT_XFER_WRITE]));
   }
 
-  CHECK_CONF(cmd, CONF_ROOT);
+  if (fault_stall.start_usecs > 0) {
+    pr_trace_msg(trace_channel, 5,
+      "session ended while stalled, after %lu ms",
+      (unsigned long) ((fault_now_usecs() - fault_stall.start_usecs) / 1000));
+  }
 
-  error_category = cmd->argv[1];
+  if (fault_stall.stalls > 0) {
+    pr_trace_msg(trace_channel, 5, "stalls: %lu, %lu ms total",
+      fault_stall.stalls, (unsigned long) ((fault_stall.total_usecs +
+      (fault_stall.start_usecs > 0 ?
+        fault_now_usecs() - fault_stall.start_usecs : 0)) / 1000));
+  }
 
-  /* Note that this category allows for future APIs/errors, such as NetIO. */
-  if (strcasecmp(error_category, "filesystem") != 0) {
-    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unsupported category: ",
-      error_category, NULL));
+  for (i = 0; i < FAULT_AUTH_NOPS; i++) {
+    if (fault_auth_delayed[i] > 0 &&
+        fault_auth_delay_usecs[i] != FAULT_DELAY_FOREVER) {
+      pr_trace_msg(trace_channel, 5,
+        "auth delay for '%s': %lu lookups delayed (%lu usecs total)",
+        fault_auth_operations[i], fault_auth_delayed[i],
+        fault_auth_delayed[i] * fault_auth_delay_usecs[i]);
+    }
   }
 
-  error_text = cmd->argv[2];
-  xerrno = fault_text2errno(error_text);
-  if (xerrno < 0) {
-    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown/unsupported error: ",
-      error_text, NULL));
+  c = find_config(main_server->conf, CONF_PARAM, "FaultCommandDelay", TRUE);
+  while (c != NULL) {
+    const struct fault_command_delay *delay;
+
+    delay = c->argv[0];
+    if (delay->delayed > 0) {
+      pr_trace_msg(trace_channel, 5,
+        "command delay for '%s'%s: %lu commands delayed (%lu usecs total)",
+        ((char **) delay->commands->elts)[0],
+        delay->commands->nelts > 1 ? " et al" : "", delay->delayed,
+        delay->delayed_usecs);
+    }
+
+    c = find_config_next(c, c->next, CONF_PARAM, "FaultCommandDelay", TRUE);
   }
 
-  for (i = 3; i < cmd->argc; i++) {
-    const char *oper;
+  if (fault_retr_count[FAULT_RETR_VIA_READ] > 0 ||
+      fault_retr_count[FAULT_RETR_VIA_SENDFILE] > 0) {
+    pr_trace_msg(trace_channel, 5,
+      "RETR transfers: %lu using read (%" PR_LU " bytes), %lu using sendfile "
+      "(%" PR_LU " bytes)", fault_retr_count[FAULT_RETR_VIA_READ],
+      (pr_off_t) fault_retr_bytes[FAULT_RETR_VIA_READ],
+      fault_retr_count[FAULT_RETR_VIA_SENDFILE],
+      (pr_off_t) fault_retr_bytes[FAULT_RETR_VIA_SENDFILE]);
+  }
 
-    oper = cmd->argv[i];
+  if (fault_log.suppressed > 0) {
+    pr_trace_msg(trace_channel, 4,
+      "fault log: %lu injected faults logged, %lu suppressed",
+      fault_log.logged, fault_log.suppressed);
+  }
 
-    if (supported_fsio_operation(oper) < 0) {
-      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
-        "unknown/unsupported ", error_category, " operation: ", oper, NULL));
+  if (fault_volumes != NULL) {
+    register unsigned int i;
+    struct fault_volume **vols;
+
+    vols = fault_volumes->elts;
+    for (i = 0; i < fault_volumes->nelts; i++) {
+      pr_trace_msg(trace_channel, 5,
+        "volume '%s': %lu ops, %lu throttled (%lu usecs total); "
+        "%lu ops, %lu throttled, %.0f credits remaining across all sessions",
+        vols[i]->path, vols[i]->ops, vols[i]->throttled_ops,
+        (unsigned long) vols[i]->throttle_usecs, vols[i]->bucket->ops,
+        vols[i]->bucket->throttled_ops, vols[i]->bucket->credits);
     }
+  }
 
-    if (pr_table_exists(fault_fsio_errtab, oper) > 0) {
-      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, error_category,
-        " configuration already exists for '", oper, "'", NULL));
-    }
+  if (fault_page_cache != NULL) {
+    unsigned long total;
+
+    total = fault_page_cache_hits + fault_page_cache_misses;
+    pr_trace_msg(trace_channel, 5,
+      "page cache: %lu hits, %lu misses (%.1f%% hit ratio); "
+      "%lu hits, %lu misses, %lu/%lu extents resident across all sessions",
+      fault_page_cache_hits, fault_page_cache_misses,
+      total > 0 ? (100.0 * fault_page_cache_hits) / total : 0.0,
+      fault_page_cache->hits, fault_page_cache->misses,
+      fault_page_cache->npages, fault_page_cache->max_pages);
+  }
 
-    /* Note that the table API copies the key pointer as is, thus we
-     * need to use a key pointer of a longer lifetime than this parsing
-     * record pool.
-     */
-    if (pr_table_add_dup(fault_fsio_errtab, pstrdup(fault_pool, oper),
-        &xerrno, sizeof(int)) < 0) {
-      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
-        "error configuring ", error_category, " fault injection for '", oper,
-        "': ", strerror(errno), NULL));
-    }
+  if (fault_seek_model != NULL) {
+    pr_trace_msg(trace_channel, 5,
+      "seek model: %lu sequential accesses, %lu seeks (%lu usecs total)",
+      fault_seek_model->sequential, fault_seek_model->seeks,
+      (unsigned long) fault_seek_model->seek_usecs);
   }
 
-  return PR_HANDLED(cmd);
+  if (fault_writeback != NULL) {
+    pr_trace_msg(trace_channel, 5,
+      "write-back: %lu flushes, %" PR_LU " bytes (%lu usecs total, "
+      "%lu usecs max)", fault_writeback->flushes,
+      (pr_off_t) fault_writeback->flushed_bytes,
+      (unsigned long) fault_writeback->flush_usecs,
+      (unsigned long) fault_writeback->max_flush_usecs);
+  }
 }
 
-/* Event handlers
- */
-
 #if defined(PR_SHARED_MODULE)
 static void fault_mod_unload_ev(const void *event_data, void *user_data) {
   if (strcmp("mod_fault.c", (const char *) event_data) != 0) {
@@ -631,22 +6106,24 @@ static void fault_mod_unload_ev(const void *event_data, void *user_data) {
   (void) pr_unmount_fs("/", "fault");
   pr_event_unregister(&fault_module, NULL, NULL);
 
+  fault_volumes_unmap();
+  fault_page_cache_unmap();
   destroy_pool(fault_pool);
   fault_pool = NULL;
-  fault_fsio_errtab = NULL;
   fault_engine = FALSE;
 }
 #endif /* PR_SHARED_MODULE */
 
 static void fault_restart_ev(const void *event_data, void *user_data) {
+  fault_volumes_unmap();
+  fault_page_cache_unmap();
+
   if (fault_pool != NULL) {
     destroy_pool(fault_pool);
   }
 
   fault_pool = make_sub_pool(permanent_pool);
   pr_pool_tag(fault_pool, MOD_FAULT_VERSION);
-
-  fault_fsio_errtab = pr_table_alloc(fault_pool, 0);
 }
 
 /* Initialization functions
@@ -663,7 +6140,6 @@ static int fault_init(void) {
   fault_pool = make_sub_pool(permanent_pool);
   pr_pool_tag(fault_pool, MOD_FAULT_VERSION);
 
-  fault_fsio_errtab = pr_table_alloc(fault_pool, 0);
   return 0;
 }
 
@@ -672,28 +6148,217 @@ static int fault_init(void) {
  */
 static int fault_sess_init(void) {
   config_rec *c;
-  int fsio_fault_count;
+  int have_rules = FALSE;
+
+  /* FaultEngine may be enabled in only some of the contexts which apply to
+   * this session, e.g. just for an <Anonymous> login, or a <Directory>.
+   */
+  c = find_config(main_server->conf, CONF_PARAM, "FaultEngine", TRUE);
+  while (c != NULL) {
+    pr_signals_handle();
+
+    if (*((int *) c->argv[0]) == TRUE) {
+      fault_engine = TRUE;
+      break;
+    }
 
-  c = find_config(main_server->conf, CONF_PARAM, "FaultEngine", FALSE);
-  if (c == NULL) {
-    return 0;
+    c = find_config_next(c, c->next, CONF_PARAM, "FaultEngine", TRUE);
   }
 
-  fault_engine = *((int *) c->argv[0]);
   if (fault_engine == FALSE) {
     return 0;
   }
 
-  fsio_fault_count = pr_table_count(fault_fsio_errtab);
-  if (fsio_fault_count > 0) {
+  /* Unsampled sessions do nothing more, and thus stay on the native
+   * filesystem.
+   */
+  c = find_config(main_server->conf, CONF_PARAM, "FaultEngine", FALSE);
+  if (c != NULL) {
+    double sample;
+    int sample_by;
+    uint64_t seed;
+
+    sample = *((double *) c->argv[1]);
+    sample_by = *((int *) c->argv[2]);
+    seed = *((uint64_t *) c->argv[3]);
+
+    if (fault_sample_session(sample, sample_by, seed) == FALSE) {
+      pr_trace_msg(trace_channel, 7,
+        "session not sampled (sample %0.4f), not injecting faults", sample);
+      fault_engine = FALSE;
+      return 0;
+    }
+  }
+
+  fault_random_seed(((uint64_t) time(NULL) << 32) ^
+    ((uint64_t) getpid() << 16) ^ fault_now_usecs());
+
+  memset(&fault_log, 0, sizeof(fault_log));
+  c = find_config(main_server->conf, CONF_PARAM, "FaultLog", FALSE);
+  if (c != NULL) {
+    fault_log.mode = *((int *) c->argv[0]);
+    fault_log.limit = *((unsigned long *) c->argv[1]);
+  }
+
+  if (fault_page_cache != NULL) {
+    pr_trace_msg(trace_channel, 7,
+      "page cache emulation enabled: %lu extents of %" PR_LU " bytes, "
+      "%lu usecs cold latency", fault_page_cache->max_pages,
+      (pr_off_t) fault_page_cache->extentsz, fault_page_cache->cold_usecs);
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "FaultSeekModel", FALSE);
+  if (c != NULL) {
+    fault_seek_model = pcalloc(session.pool, sizeof(struct fault_seek_model));
+    fault_seek_model->usecs_per_gb = *((unsigned long *) c->argv[0]);
+    fault_seek_model->rotational_usecs = *((unsigned long *) c->argv[1]);
+    fault_seek_model->max_seek_usecs = *((unsigned long *) c->argv[2]);
+
+    pr_trace_msg(trace_channel, 7,
+      "seek model enabled: %lu usecs per GB, %lu usecs rotational latency",
+      fault_seek_model->usecs_per_gb, fault_seek_model->rotational_usecs);
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "FaultWriteBack", FALSE);
+  if (c != NULL) {
+    fault_writeback = pcalloc(session.pool, sizeof(struct fault_writeback));
+    fault_writeback->flush_bps = *((off_t *) c->argv[0]);
+    fault_writeback->max_dirty = *((off_t *) c->argv[1]);
+
+    pr_trace_msg(trace_channel, 7,
+      "write-back emulation enabled: %" PR_LU " bytes/sec flush bandwidth",
+      (pr_off_t) fault_writeback->flush_bps);
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "FaultProfile", FALSE);
+  if (c != NULL) {
+    fault_profile = *((int *) c->argv[0]);
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "FaultSlowOpThreshold",
+    FALSE);
+  if (c != NULL) {
+    fault_slow_op_usecs = *((unsigned long *) c->argv[0]);
+    fault_op_ringsz = *((unsigned int *) c->argv[1]);
+
+    if (fault_op_ringsz > 0) {
+      fault_op_ring = pcalloc(session.pool,
+        sizeof(struct fault_op_record) * fault_op_ringsz);
+    }
+  }
+
+  if (fault_profile == TRUE ||
+      fault_slow_op_usecs > 0) {
+    fault_time_ops = TRUE;
+  }
+
+  /* Profiling needs the handles' offsets. */
+  if (fault_page_cache != NULL ||
+      fault_seek_model != NULL ||
+      fault_writeback != NULL ||
+      fault_profile == TRUE) {
+    fault_track_handles = TRUE;
+  }
+
+  if (find_config(main_server->conf, CONF_PARAM, "FaultRules",
+      TRUE) != NULL) {
+    have_rules = TRUE;
+  }
+
+  if (find_config(main_server->conf, CONF_PARAM, "FaultCommandDelay",
+      TRUE) != NULL) {
+    fault_have_command_delays = TRUE;
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "FaultAuthDelay", FALSE);
+  while (c != NULL) {
+    register unsigned int i;
+    int idx;
+    unsigned long delay_usecs;
+
+    pr_signals_handle();
+
+    idx = *((int *) c->argv[0]);
+    delay_usecs = *((unsigned long *) c->argv[1]);
+
+    for (i = 0; i < FAULT_AUTH_NOPS; i++) {
+      if (idx < 0 ||
+          (int) i == idx) {
+        fault_auth_delay_usecs[i] = delay_usecs;
+      }
+    }
+
+    c = find_config_next(c, c->next, CONF_PARAM, "FaultAuthDelay", FALSE);
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "FaultNetIO", FALSE);
+  while (c != NULL) {
+    pr_signals_handle();
+
+    if (fault_netio_rules == NULL) {
+      fault_netio_rules = make_array(session.pool, 0,
+        sizeof(struct fault_netio_rule *));
+    }
+
+    *((struct fault_netio_rule **) push_array(fault_netio_rules)) = c->argv[0];
+    c = find_config_next(c, c->next, CONF_PARAM, "FaultNetIO", FALSE);
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "FaultFragment", FALSE);
+  while (c != NULL) {
+    int strm_types, dirs;
+    size_t max_io;
+
+    pr_signals_handle();
+
+    max_io = *((size_t *) c->argv[0]);
+    strm_types = *((int *) c->argv[1]);
+    dirs = *((int *) c->argv[2]);
+
+    if (strm_types & PR_NETIO_STRM_CTRL) {
+      if (dirs & FAULT_FRAGMENT_READ) {
+        fault_netio_max_io[FAULT_NETIO_CTRL][FAULT_XFER_READ] = max_io;
+      }
+
+      if (dirs & FAULT_FRAGMENT_WRITE) {
+        fault_netio_max_io[FAULT_NETIO_CTRL][FAULT_XFER_WRITE] = max_io;
+      }
+    }
+
+    if (strm_types & PR_NETIO_STRM_DATA) {
+      if (dirs & FAULT_FRAGMENT_READ) {
+        fault_netio_max_io[FAULT_NETIO_DATA][FAULT_XFER_READ] = max_io;
+      }
+
+      if (dirs & FAULT_FRAGMENT_WRITE) {
+        fault_netio_max_io[FAULT_NETIO_DATA][FAULT_XFER_WRITE] = max_io;
+      }
+    }
+
+    c = find_config_next(c, c->next, CONF_PARAM, "FaultFragment", FALSE);
+  }
+
+  fault_netio_register();
+
+  pr_event_register(&fault_module, "core.exit", fault_exit_ev, NULL);
+
+  /* The rules in effect may change once the user has logged in, e.g. for
+   * an <Anonymous> login, or once chrooted; see fault_post_pass().
+   */
+  fault_compile_rules();
+
+  if (have_rules == TRUE ||
+      fault_track_handles == TRUE ||
+      fault_volumes != NULL ||
+      fault_time_ops == TRUE) {
     pr_fs_t *fs;
 
     pr_trace_msg(trace_channel, 7,
-      "filesystem fault injections (%d) configured, registering custom FS",
-      fsio_fault_count);
+      "filesystem fault injections (%u) configured, registering custom FS",
+      fault_sess_rules->nelts);
 
     if (pr_trace_get_level(trace_channel) >= 20) {
-      fault_tab_dump(fault_fsio_errtab);
+      fault_rules_dump();
     }
 
     /* Register our custom filesystem. */
@@ -706,6 +6371,7 @@ static int fault_sess_init(void) {
       fs->closedir = fault_fsio_closedir;
       fs->fchmod = fault_fsio_fchmod;
       fs->fchown = fault_fsio_fchown;
+      fs->fsync = fault_fsio_fsync;
       fs->futimes = fault_fsio_futimes;
       fs->lchown = fault_fsio_lchown;
       fs->lseek = fault_fsio_lseek;
@@ -731,11 +6397,63 @@ static int fault_sess_init(void) {
  */
 
 static conftable fault_conftab[] = {
+  { "FaultBandwidth",		set_faultbandwidth,	NULL },
+  { "FaultBurst",		set_faultburst,		NULL },
+  { "FaultDelay",		set_faultdelay,		NULL },
   { "FaultEngine",		set_faultengine,	NULL },
+  { "FaultFragment",		set_faultfragment,	NULL },
   { "FaultInject",		set_faultinject,	NULL },
+  { "FaultLog",			set_faultlog,		NULL },
+  { "FaultPageCache",		set_faultpagecache,	NULL },
+  { "FaultProfile",		set_faultprofile,	NULL },
+  { "FaultSeekModel",		set_faultseekmodel,	NULL },
+  { "FaultSlowOpThreshold",	set_faultslowopthreshold, NULL },
+  { "FaultVolume",		set_faultvolume,	NULL },
+  { "FaultWriteBack",		set_faultwriteback,	NULL },
   { NULL }
 };
 
+static cmdtable fault_cmdtab[] = {
+  { PRE_CMD,		C_ANY,	G_NONE,	fault_pre_cmd,		FALSE,	FALSE },
+  { PRE_CMD,		C_RETR,	G_NONE,	fault_pre_retr,		FALSE,	FALSE },
+  { POST_CMD,		C_ANY,	G_NONE,	fault_post_cmd,		FALSE,	FALSE },
+  { POST_CMD_ERR,	C_ANY,	G_NONE,	fault_post_cmd,		FALSE,	FALSE },
+  { POST_CMD,		C_PASS,	G_NONE,	fault_post_pass,	FALSE,	FALSE },
+  { POST_CMD,		C_RETR,	G_NONE,	fault_post_retr,	FALSE,	FALSE },
+  { POST_CMD_ERR,	C_RETR,	G_NONE,	fault_post_retr,	FALSE,	FALSE },
+
+  { PRE_CMD,		C_APPE,	G_NONE,	fault_pre_xfer,		FALSE,	FALSE },
+  { PRE_CMD,		C_RETR,	G_NONE,	fault_pre_xfer,		FALSE,	FALSE },
+  { PRE_CMD,		C_STOR,	G_NONE,	fault_pre_xfer,		FALSE,	FALSE },
+  { PRE_CMD,		C_STOU,	G_NONE,	fault_pre_xfer,		FALSE,	FALSE },
+  { POST_CMD,		C_APPE,	G_NONE,	fault_post_xfer,	FALSE,	FALSE },
+  { POST_CMD,		C_RETR,	G_NONE,	fault_post_xfer,	FALSE,	FALSE },
+  { POST_CMD,		C_STOR,	G_NONE,	fault_post_xfer,	FALSE,	FALSE },
+  { POST_CMD,		C_STOU,	G_NONE,	fault_post_xfer,	FALSE,	FALSE },
+  { POST_CMD_ERR,	C_APPE,	G_NONE,	fault_post_xfer,	FALSE,	FALSE },
+  { POST_CMD_ERR,	C_RETR,	G_NONE,	fault_post_xfer,	FALSE,	FALSE },
+  { POST_CMD_ERR,	C_STOR,	G_NONE,	fault_post_xfer,	FALSE,	FALSE },
+  { POST_CMD_ERR,	C_STOU,	G_NONE,	fault_post_xfer,	FALSE,	FALSE },
+
+  { 0, NULL }
+};
+
+static authtable fault_authtab[] = {
+  { 0, "auth",		fault_auth_auth },
+  { 0, "check",		fault_auth_check },
+  { 0, "getgrgid",	fault_auth_getgrgid },
+  { 0, "getgrnam",	fault_auth_getgrnam },
+  { 0, "getgroups",	fault_auth_getgroups },
+  { 0, "getpwnam",	fault_auth_getpwnam },
+  { 0, "getpwuid",	fault_auth_getpwuid },
+  { 0, "gid2name",	fault_auth_gid2name },
+  { 0, "name2gid",	fault_auth_name2gid },
+  { 0, "name2uid",	fault_auth_name2uid },
+  { 0, "uid2name",	fault_auth_uid2name },
+
+  { 0, NULL }
+};
+
 module fault_module = {
   NULL, NULL,
 
@@ -749,10 +6467,10 @@ module fault_module = {
   fault_conftab,
 
   /* Module command handler table */
-  NULL,
+  fault_cmdtab,
 
   /* Module authentication handler table */
-  NULL,
+  fault_authtab,
 
   /* Module initialization function */
   fault_init,
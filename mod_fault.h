@@ -0,0 +1,57 @@
+/*
+ * ProFTPD: mod_fault -- a module for fault injection
+ * Copyright (c) 2022 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_FAULT_H
+#define MOD_FAULT_H
+
+/* Events generated by mod_fault, for other modules to listen for.  Both
+ * events carry a pointer to a struct fault_event_data, which is only valid
+ * for the duration of the event callback.
+ */
+#define FAULT_EVENT_FAULT_INJECTED	"mod_fault.fault-injected"
+#define FAULT_EVENT_DELAY_INJECTED	"mod_fault.delay-injected"
+
+struct fault_event_data {
+  /* The fault category: "filesystem", "netio", "command", or "auth". */
+  const char *category;
+
+  /* The operation, e.g. "read" or "mkdir", or the command, e.g. "PASV". */
+  const char *oper;
+
+  /* The path (or the file handle's path) involved, if known; may be NULL. */
+  const char *path;
+
+  /* For fault-injected events, the errno being injected; zero otherwise. */
+  int xerrno;
+
+  /* For delay-injected events, the delay about to be applied. */
+  unsigned long delay_usecs;
+
+  /* What caused the fault or delay: "rule", "page-cache", "seek",
+   * "write-back", "bandwidth", or "volume".
+   */
+  const char *cause;
+};
+
+#endif /* MOD_FAULT_H */
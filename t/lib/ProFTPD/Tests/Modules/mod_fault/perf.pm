@@ -0,0 +1,1006 @@
+package ProFTPD::Tests::Modules::mod_fault::perf;
+
+use lib qw(t/lib);
+use base qw(ProFTPD::TestSuite::Child);
+use strict;
+
+use File::Path qw(mkpath);
+use File::Spec;
+use IO::Handle;
+use POSIX qw(:fcntl_h strftime);
+use Time::HiRes qw(gettimeofday tv_interval);
+
+use ProFTPD::TestSuite::FTP;
+use ProFTPD::TestSuite::Utils qw(:auth :config :running :test :testsuite);
+
+$| = 1;
+
+my $order = 0;
+
+my $TESTS = {
+  fault_perf_retr => {
+    order => ++$order,
+    test_class => [qw(forking slow)],
+  },
+
+  fault_perf_retr_sendfile => {
+    order => ++$order,
+    test_class => [qw(forking slow)],
+  },
+
+  fault_perf_stor => {
+    order => ++$order,
+    test_class => [qw(forking slow)],
+  },
+
+  fault_perf_list => {
+    order => ++$order,
+    test_class => [qw(forking slow)],
+  },
+
+  fault_perf_concurrency_ftp => {
+    order => ++$order,
+    test_class => [qw(forking slow)],
+  },
+
+  fault_perf_concurrency_sftp => {
+    order => ++$order,
+    test_class => [qw(forking mod_sftp slow)],
+  },
+
+  fault_perf_overhead_retr => {
+    order => ++$order,
+    test_class => [qw(forking slow)],
+  },
+
+  fault_perf_overhead_stor => {
+    order => ++$order,
+    test_class => [qw(forking slow)],
+  },
+
+  fault_perf_overhead_list => {
+    order => ++$order,
+    test_class => [qw(forking slow)],
+  },
+
+};
+
+# The named fault profiles; each workload is run once under each of these,
+# in this order.
+my $PROFILES = [
+  {
+    name => 'clean',
+    config => {
+      FaultEngine => 'on',
+    },
+  },
+
+  {
+    name => 'write-latency-5ms',
+    config => {
+      FaultEngine => 'on',
+      FaultDelay => 'filesystem 5ms write',
+    },
+  },
+
+  {
+    name => 'bandwidth-20MBps',
+    config => {
+      FaultEngine => 'on',
+      FaultBandwidth => 'filesystem 20MB/s read write',
+    },
+  },
+
+  {
+    name => 'eio-1pct',
+    config => {
+      FaultEngine => 'on',
+      FaultInject => 'filesystem EIO read write probability=1%',
+    },
+  },
+];
+
+# Workload sizes; these can be overridden from the environment, to make
+# longer (and less noisy) runs when comparing builds.
+my $PERF_ITERATIONS = $ENV{FAULT_PERF_ITERATIONS} || 5;
+my $PERF_FILE_SIZE = $ENV{FAULT_PERF_FILE_SIZE} || (4 * 1024 * 1024);
+my $PERF_LIST_FILES = $ENV{FAULT_PERF_LIST_FILES} || 500;
+
+# The numbers of concurrent sessions for the scaling tests, and the
+# operations each session performs.
+my $PERF_SESSIONS = [split(/,/, $ENV{FAULT_PERF_SESSIONS} || '1,8,64,256')];
+my $PERF_SESSION_FILE_SIZE = $ENV{FAULT_PERF_SESSION_FILE_SIZE} ||
+  (256 * 1024);
+my $PERF_SESSION_MKDS = 4;
+
+# For the overhead tests: how many rounds to run (taking the best of each),
+# how many transfers per round, and how much slower than the baseline (as a
+# percentage) an idle mod_fault may be.
+my $PERF_OVERHEAD_ROUNDS = $ENV{FAULT_PERF_OVERHEAD_ROUNDS} || 5;
+my $PERF_OVERHEAD_ITERATIONS = $ENV{FAULT_PERF_OVERHEAD_ITERATIONS} || 25;
+my $PERF_OVERHEAD_THRESHOLD = defined($ENV{FAULT_PERF_OVERHEAD_THRESHOLD}) ?
+  $ENV{FAULT_PERF_OVERHEAD_THRESHOLD} : 1.0;
+
+# The baseline has the module loaded but disabled, in which case it does not
+# register its filesystem; the idle profiles should cost (almost) the same.
+my $OVERHEAD_PROFILES = [
+  {
+    name => 'baseline',
+    config => {
+      FaultEngine => 'off',
+    },
+  },
+
+  {
+    name => 'idle-no-rules',
+    config => {
+      FaultEngine => 'on',
+    },
+  },
+
+  {
+    name => 'idle-unrelated-rules',
+    config => {
+      FaultEngine => 'on',
+      FaultInject => 'filesystem EIO rmdir rename',
+      FaultDelay => 'filesystem 1s chown',
+    },
+  },
+];
+
+sub new {
+  return shift()->SUPER::new(@_);
+}
+
+sub list_tests {
+  return testsuite_get_runnable_tests($TESTS);
+}
+
+# Support functions
+
+sub perf_csv_path {
+  my $tmpdir = shift;
+
+  if (defined($ENV{FAULT_PERF_CSV})) {
+    return $ENV{FAULT_PERF_CSV};
+  }
+
+  return File::Spec->rel2abs("$tmpdir/fault-perf.csv");
+}
+
+sub perf_csv_write {
+  my $path = shift;
+  my $row = shift;
+
+  my $columns = [qw(
+    timestamp build profile workload io_path sessions iterations failures bytes
+    elapsed_secs throughput_bps avg_latency_ms max_latency_ms faults
+  )];
+
+  my $need_header = (-s $path) ? 0 : 1;
+
+  if (open(my $fh, ">> $path")) {
+    if ($need_header) {
+      print $fh join(',', @$columns), "\n";
+    }
+
+    print $fh join(',', map { $row->{$_} } @$columns), "\n";
+
+    unless (close($fh)) {
+      die("Can't write $path: $!");
+    }
+
+  } else {
+    die("Can't open $path: $!");
+  }
+
+  if ($ENV{TEST_VERBOSE}) {
+    print STDERR "# ", join(' ', map { "$_=$row->{$_}" } @$columns), "\n";
+  }
+}
+
+# Sum the injected faults, as reported per rule by mod_fault at session end.
+# If an operation name is given, returns the summed calls and faults for
+# just that operation.
+sub perf_count_faults {
+  my $log_file = shift;
+  my $oper = shift;
+
+  my $calls = 0;
+  my $faults = 0;
+
+  if (open(my $fh, "< $log_file")) {
+    while (my $line = <$fh>) {
+      if ($line =~ /rule '(\S+)': (\d+) calls, (\d+) faults/) {
+        next if defined($oper) && $1 ne $oper;
+
+        $calls += $2;
+        $faults += $3;
+      }
+    }
+
+    close($fh);
+
+  } else {
+    die("Can't read $log_file: $!");
+  }
+
+  return wantarray() ? ($calls, $faults) : $faults;
+}
+
+# Sum the RETR transfers which used read, and those which used sendfile, as
+# reported by mod_fault at session end.
+sub perf_count_retrs {
+  my $log_file = shift;
+
+  my $reads = 0;
+  my $sendfiles = 0;
+
+  if (open(my $fh, "< $log_file")) {
+    while (my $line = <$fh>) {
+      if ($line =~ /RETR transfers: (\d+) using read .*, (\d+) using sendfile/) {
+        $reads += $1;
+        $sendfiles += $2;
+      }
+    }
+
+    close($fh);
+
+  } else {
+    die("Can't read $log_file: $!");
+  }
+
+  return ($reads, $sendfiles);
+}
+
+# Describes how the data were read, for the CSV: "sendfile" or "read-write",
+# or "mixed" if some downloads used each.
+sub perf_io_path {
+  my $log_file = shift;
+
+  my ($reads, $sendfiles) = perf_count_retrs($log_file);
+  if ($sendfiles > 0) {
+    return $reads > 0 ? 'mixed' : 'sendfile';
+  }
+
+  return 'read-write';
+}
+
+sub perf_make_file {
+  my $path = shift;
+  my $size = shift;
+
+  if (open(my $fh, "> $path")) {
+    my $chunk = "A" x 65536;
+    my $written = 0;
+
+    while ($written < $size) {
+      my $len = $size - $written;
+      $len = length($chunk) if $len > length($chunk);
+
+      print $fh substr($chunk, 0, $len);
+      $written += $len;
+    }
+
+    unless (close($fh)) {
+      die("Can't write $path: $!");
+    }
+
+  } else {
+    die("Can't open $path: $!");
+  }
+}
+
+# Runs a single data transfer command, returning the number of bytes
+# transferred; dies if the command fails.
+sub perf_transfer {
+  my $client = shift;
+  my $workload = shift;
+  my $iteration = shift;
+  my $path = shift;
+  $path = 'perf.dat' unless defined($path);
+
+  my $conn;
+  my $bytes = 0;
+
+  if ($workload eq 'RETR') {
+    $conn = $client->retr_raw($path);
+
+  } elsif ($workload eq 'STOR') {
+    $conn = $client->stor_raw("perf-$iteration.dat");
+
+  } elsif ($workload eq 'LIST') {
+    $conn = $client->list_raw('list.d');
+  }
+
+  unless ($conn) {
+    die("$workload failed: " . $client->response_code() . " " .
+      $client->response_msg());
+  }
+
+  if ($workload eq 'STOR') {
+    my $buf = "A" x 65536;
+
+    while ($bytes < $PERF_FILE_SIZE) {
+      my $len = $PERF_FILE_SIZE - $bytes;
+      $len = length($buf) if $len > length($buf);
+
+      $conn->write($buf, $len, 25);
+      $bytes += $len;
+    }
+
+  } else {
+    my $buf;
+    while (my $len = $conn->read($buf, 65536, 25)) {
+      $bytes += $len;
+    }
+  }
+
+  eval { $conn->close() };
+
+  my $resp_code = $client->response_code();
+  unless ($resp_code == 226) {
+    die("$workload failed: $resp_code " . $client->response_msg());
+  }
+
+  return $bytes;
+}
+
+# Runs the given workload under each of the fault profiles, recording a CSV
+# row for each.  Returns the rows, keyed by profile name.
+#
+# The optional opts can provide other profiles, the number of iterations
+# per run, and the number of rounds.  Over several rounds, the profiles are
+# interleaved, and the row with the best throughput is returned for each.
+# Downloads only use sendfile(2) if the sendfile option is set.
+sub perf_run_profiles {
+  my $self = shift;
+  my $workload = shift;
+  my $opts = shift;
+  $opts = {} unless defined($opts);
+
+  my $profiles = $opts->{profiles} || $PROFILES;
+  my $iterations = $opts->{iterations} || $PERF_ITERATIONS;
+  my $rounds = $opts->{rounds} || 1;
+  my $use_sendfile = $opts->{sendfile} ? 'on' : 'off';
+
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'fault');
+
+  perf_make_file(File::Spec->rel2abs("$tmpdir/perf.dat"), $PERF_FILE_SIZE);
+
+  my $list_dir = File::Spec->rel2abs("$tmpdir/list.d");
+  mkpath($list_dir);
+  for (my $i = 0; $i < $PERF_LIST_FILES; $i++) {
+    perf_make_file("$list_dir/file-$i.txt", 16);
+  }
+
+  my $csv_path = perf_csv_path($tmpdir);
+  my $build = $ENV{FAULT_PERF_BUILD} || $ENV{PROFTPD_TEST_BIN};
+  my $results = {};
+
+  my $runs = [];
+  for (my $round = 0; $round < $rounds; $round++) {
+    push(@$runs, @$profiles);
+  }
+
+  foreach my $profile (@$runs) {
+    my $log_file = File::Spec->rel2abs("$tmpdir/$profile->{name}.log");
+
+    my $config = {
+      PidFile => $setup->{pid_file},
+      ScoreboardFile => $setup->{scoreboard_file},
+      SystemLog => $log_file,
+      TraceLog => $log_file,
+
+      # Keep tracing to a minimum, so as not to skew the numbers; level 5
+      # is enough for the per-rule fault counts.
+      Trace => 'fault:5',
+
+      AuthUserFile => $setup->{auth_user_file},
+      AuthGroupFile => $setup->{auth_group_file},
+      AuthOrder => 'mod_auth_file.c',
+
+      # Unless asked otherwise, make sure that our reads go through FSIO
+      UseSendfile => $use_sendfile,
+
+      IfModules => {
+        'mod_delay.c' => {
+          DelayEngine => 'off',
+        },
+
+        'mod_fault.c' => $profile->{config},
+      },
+    };
+
+    my ($port, $config_user, $config_group) = config_write(
+      $setup->{config_file}, $config);
+
+    # Open pipes, for use between the parent and child processes.
+    # Specifically, the child will indicate when it's done with its test by
+    # writing a message to the parent.
+    my ($rfh, $wfh);
+    unless (pipe($rfh, $wfh)) {
+      die("Can't open pipe: $!");
+    }
+
+    my $ex;
+    my $latencies = [];
+    my $failures = 0;
+    my $error_responses = 0;
+    my $total_bytes = 0;
+    my $total_elapsed = 0;
+
+    # Fork child
+    $self->handle_sigchld();
+    defined(my $pid = fork()) or die("Can't fork: $!");
+    if ($pid) {
+      eval {
+        # Allow the server to start up
+        sleep(1);
+
+        my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+        $client->login($setup->{user}, $setup->{passwd});
+        $client->type('binary');
+
+        my $run_start = [gettimeofday()];
+
+        for (my $i = 0; $i < $iterations; $i++) {
+          my $start = [gettimeofday()];
+
+          my $bytes = eval { perf_transfer($client, $workload, $i) };
+          if ($@) {
+            # Expected for the error profiles; anything else is a failure.
+            $failures++;
+
+            my $resp_code = $client->response_code();
+            if ($resp_code =~ /^[45]/) {
+              $error_responses++;
+            }
+
+            next;
+          }
+
+          push(@$latencies, tv_interval($start));
+          $total_bytes += $bytes;
+        }
+
+        $total_elapsed = tv_interval($run_start);
+        $client->quit();
+      };
+      if ($@) {
+        $ex = $@;
+      }
+
+      $wfh->print("done\n");
+      $wfh->flush();
+
+    } else {
+      eval { server_wait($setup->{config_file}, $rfh) };
+      if ($@) {
+        warn($@);
+        exit 1;
+      }
+
+      exit 0;
+    }
+
+    # Stop server
+    server_stop($setup->{pid_file});
+    $self->assert_child_ok($pid);
+
+    if ($ex) {
+      test_cleanup($log_file, $ex);
+    }
+
+    my $max_latency = 0;
+    my $sum_latency = 0;
+    foreach my $latency (@$latencies) {
+      $sum_latency += $latency;
+      $max_latency = $latency if $latency > $max_latency;
+    }
+
+    my $nlatencies = scalar(@$latencies);
+
+    my $row = {
+      timestamp => strftime('%Y-%m-%dT%H:%M:%S', localtime()),
+      build => $build,
+      profile => $profile->{name},
+      workload => $workload,
+      io_path => perf_io_path($log_file),
+      sessions => 1,
+      iterations => $iterations,
+      failures => $failures,
+      error_responses => $error_responses,
+      bytes => $total_bytes,
+      elapsed_secs => sprintf('%.6f', $total_elapsed),
+      throughput_bps => sprintf('%.0f',
+        $total_elapsed > 0 ? $total_bytes / $total_elapsed : 0),
+      avg_latency_ms => sprintf('%.3f',
+        $nlatencies > 0 ? ($sum_latency * 1000) / $nlatencies : 0),
+      max_latency_ms => sprintf('%.3f', $max_latency * 1000),
+      faults => scalar(perf_count_faults($log_file)),
+    };
+
+    perf_csv_write($csv_path, $row);
+
+    my $best = $results->{$profile->{name}};
+    if (!defined($best) ||
+        $row->{throughput_bps} > $best->{throughput_bps}) {
+      $results->{$profile->{name}} = $row;
+    }
+
+    unlink($log_file) unless $ENV{TEST_VERBOSE};
+  }
+
+  return $results;
+}
+
+# Runs a single session of the concurrency workload: download a file, then
+# attempt a few MKDs (all of which fail).  Returns the number of bytes
+# downloaded; dies if anything unexpected happens.
+sub perf_session_ftp {
+  my $port = shift;
+  my $user = shift;
+  my $passwd = shift;
+  my $id = shift;
+
+  my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port, 0, 30);
+  $client->login($user, $passwd);
+  $client->type('binary');
+
+  my $bytes = perf_transfer($client, 'RETR', 0, 'session.dat');
+
+  for (my $i = 0; $i < $PERF_SESSION_MKDS; $i++) {
+    eval { $client->mkd("dir-$id-$i") };
+    unless ($@) {
+      die("MKD dir-$id-$i succeeded unexpectedly");
+    }
+  }
+
+  $client->quit();
+  return $bytes;
+}
+
+sub perf_session_sftp {
+  my $port = shift;
+  my $user = shift;
+  my $passwd = shift;
+  my $id = shift;
+
+  my $ssh2 = Net::SSH2->new();
+
+  unless ($ssh2->connect('127.0.0.1', $port)) {
+    my ($err_code, $err_name, $err_str) = $ssh2->error();
+    die("Can't connect to SSH2 server: [$err_name] ($err_code) $err_str");
+  }
+
+  unless ($ssh2->auth_password($user, $passwd)) {
+    my ($err_code, $err_name, $err_str) = $ssh2->error();
+    die("Can't login to SSH2 server: [$err_name] ($err_code) $err_str");
+  }
+
+  my $sftp = $ssh2->sftp();
+  unless ($sftp) {
+    my ($err_code, $err_name, $err_str) = $ssh2->error();
+    die("Can't use SFTP on SSH2 server: [$err_name] ($err_code) $err_str");
+  }
+
+  my $fh = $sftp->open('session.dat', O_RDONLY);
+  unless ($fh) {
+    my ($err_code, $err_name) = $sftp->error();
+    die("Can't open session.dat: [$err_name] ($err_code)");
+  }
+
+  my $bytes = 0;
+  my $buf;
+  while (my $len = $fh->read($buf, 32768)) {
+    $bytes += $len;
+  }
+
+  # To issue the FXP_CLOSE, we have to explicitly destroy the filehandle
+  $fh = undef;
+
+  for (my $i = 0; $i < $PERF_SESSION_MKDS; $i++) {
+    if ($sftp->mkdir("dir-$id-$i")) {
+      die("mkdir dir-$id-$i succeeded unexpectedly");
+    }
+  }
+
+  $sftp = undef;
+  $ssh2->disconnect();
+
+  return $bytes;
+}
+
+# Runs the concurrency workload with each of the configured numbers of
+# concurrent sessions, recording a CSV row for each, and checking that the
+# summed per-session fault counts match what the clients saw.
+sub perf_run_sessions {
+  my $self = shift;
+  my $proto = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'fault');
+
+  perf_make_file(File::Spec->rel2abs("$tmpdir/session.dat"),
+    $PERF_SESSION_FILE_SIZE);
+
+  my $csv_path = perf_csv_path($tmpdir);
+  my $build = $ENV{FAULT_PERF_BUILD} || $ENV{PROFTPD_TEST_BIN};
+
+  my ($rsa_host_key, $dsa_host_key);
+  if ($proto eq 'SFTP') {
+    require Net::SSH2;
+
+    $rsa_host_key = File::Spec->rel2abs("$ENV{PROFTPD_TEST_DIR}/tests/t/etc/modules/mod_sftp/ssh_host_rsa_key");
+    $dsa_host_key = File::Spec->rel2abs("$ENV{PROFTPD_TEST_DIR}/tests/t/etc/modules/mod_sftp/ssh_host_dsa_key");
+
+    # Make sure that mod_sftp does not complain about permissions on the
+    # hostkey files.
+    unless (chmod(0400, $rsa_host_key, $dsa_host_key)) {
+      die("Can't set perms on $rsa_host_key, $dsa_host_key: $!");
+    }
+  }
+
+  foreach my $nsessions (@$PERF_SESSIONS) {
+    my $log_file = File::Spec->rel2abs("$tmpdir/sessions-$nsessions.log");
+
+    my $config = {
+      PidFile => $setup->{pid_file},
+      ScoreboardFile => $setup->{scoreboard_file},
+      SystemLog => $log_file,
+      TraceLog => $log_file,
+      Trace => 'fault:5',
+
+      AuthUserFile => $setup->{auth_user_file},
+      AuthGroupFile => $setup->{auth_group_file},
+      AuthOrder => 'mod_auth_file.c',
+
+      MaxInstances => $nsessions + 16,
+      TCPBackLog => $nsessions + 16,
+      UseSendfile => 'off',
+
+      IfModules => {
+        'mod_delay.c' => {
+          DelayEngine => 'off',
+        },
+
+        'mod_fault.c' => {
+          FaultEngine => 'on',
+          FaultInject => 'filesystem EACCES mkdir',
+        },
+      },
+    };
+
+    if ($proto eq 'SFTP') {
+      $config->{IfModules}->{'mod_sftp.c'} = [
+        "SFTPEngine on",
+        "SFTPLog $log_file",
+        "SFTPHostKey $rsa_host_key",
+        "SFTPHostKey $dsa_host_key",
+      ];
+    }
+
+    my ($port, $config_user, $config_group) = config_write(
+      $setup->{config_file}, $config);
+
+    # Open pipes, for use between the parent and child processes.
+    # Specifically, the child will indicate when it's done with its test by
+    # writing a message to the parent.
+    my ($rfh, $wfh);
+    unless (pipe($rfh, $wfh)) {
+      die("Can't open pipe: $!");
+    }
+
+    my $ex;
+    my $latencies = [];
+    my $failures = 0;
+    my $total_bytes = 0;
+    my $total_elapsed = 0;
+
+    # Fork child
+    $self->handle_sigchld();
+    defined(my $pid = fork()) or die("Can't fork: $!");
+    if ($pid) {
+      eval {
+        # Allow the server to start up
+        sleep(1);
+
+        # Each client session reports its outcome on this pipe, as a single
+        # line (and thus a single atomic write).
+        my ($results_rfh, $results_wfh);
+        unless (pipe($results_rfh, $results_wfh)) {
+          die("Can't open pipe: $!");
+        }
+
+        my $run_start = [gettimeofday()];
+        my $client_pids = [];
+
+        for (my $id = 0; $id < $nsessions; $id++) {
+          defined(my $client_pid = fork()) or die("Can't fork: $!");
+          if ($client_pid) {
+            push(@$client_pids, $client_pid);
+            next;
+          }
+
+          close($results_rfh);
+
+          my $start = [gettimeofday()];
+          my $bytes = eval {
+            if ($proto eq 'SFTP') {
+              perf_session_sftp($port, $setup->{user}, $setup->{passwd}, $id);
+
+            } else {
+              perf_session_ftp($port, $setup->{user}, $setup->{passwd}, $id);
+            }
+          };
+          my $ok = $@ ? 0 : 1;
+
+          $results_wfh->print("$ok " . ($bytes || 0) . " " .
+            tv_interval($start) . "\n");
+          $results_wfh->flush();
+          POSIX::_exit(0);
+        }
+
+        close($results_wfh);
+
+        while (my $line = <$results_rfh>) {
+          chomp($line);
+          my ($ok, $bytes, $elapsed) = split(' ', $line);
+
+          if ($ok) {
+            push(@$latencies, $elapsed);
+            $total_bytes += $bytes;
+
+          } else {
+            $failures++;
+          }
+        }
+
+        $total_elapsed = tv_interval($run_start);
+        close($results_rfh);
+
+        foreach my $client_pid (@$client_pids) {
+          waitpid($client_pid, 0);
+        }
+      };
+      if ($@) {
+        $ex = $@;
+      }
+
+      $wfh->print("done\n");
+      $wfh->flush();
+
+    } else {
+      eval { server_wait($setup->{config_file}, $rfh, 60) };
+      if ($@) {
+        warn($@);
+        exit 1;
+      }
+
+      exit 0;
+    }
+
+    # Stop server
+    server_stop($setup->{pid_file});
+    $self->assert_child_ok($pid);
+
+    if ($ex) {
+      test_cleanup($log_file, $ex);
+    }
+
+    my $max_latency = 0;
+    my $sum_latency = 0;
+    foreach my $latency (@$latencies) {
+      $sum_latency += $latency;
+      $max_latency = $latency if $latency > $max_latency;
+    }
+
+    my $nlatencies = scalar(@$latencies);
+    my ($mkdir_calls, $mkdir_faults) = perf_count_faults($log_file, 'mkdir');
+
+    my $row = {
+      timestamp => strftime('%Y-%m-%dT%H:%M:%S', localtime()),
+      build => $build,
+      profile => 'eacces-mkdir',
+      workload => $proto,
+      io_path => 'read-write',
+      sessions => $nsessions,
+      iterations => 1,
+      failures => $failures,
+      bytes => $total_bytes,
+      elapsed_secs => sprintf('%.6f', $total_elapsed),
+      throughput_bps => sprintf('%.0f',
+        $total_elapsed > 0 ? $total_bytes / $total_elapsed : 0),
+      avg_latency_ms => sprintf('%.3f',
+        $nlatencies > 0 ? ($sum_latency * 1000) / $nlatencies : 0),
+      max_latency_ms => sprintf('%.3f', $max_latency * 1000),
+      faults => $mkdir_faults,
+    };
+
+    perf_csv_write($csv_path, $row);
+
+    eval {
+      $self->assert($failures == 0,
+        test_msg("Expected all $nsessions $proto sessions to succeed, $failures failed"));
+
+      my $expected = $nsessions * $PERF_SESSION_MKDS;
+      $self->assert($mkdir_calls == $expected,
+        test_msg("Expected $expected mkdir calls across $nsessions sessions, got $mkdir_calls"));
+      $self->assert($mkdir_faults == $expected,
+        test_msg("Expected $expected mkdir faults across $nsessions sessions, got $mkdir_faults"));
+    };
+    if ($@) {
+      test_cleanup($log_file, $@);
+    }
+
+    unlink($log_file) unless $ENV{TEST_VERBOSE};
+  }
+}
+
+# Checks that hold for every workload, regardless of the numbers.
+sub perf_check_results {
+  my $self = shift;
+  my $workload = shift;
+  my $results = shift;
+
+  foreach my $name ('clean', 'write-latency-5ms', 'bandwidth-20MBps') {
+    my $row = $results->{$name};
+
+    $self->assert($row->{failures} == 0,
+      test_msg("Expected no failed $workload commands for '$name' profile, got $row->{failures}"));
+    $self->assert($row->{faults} == 0,
+      test_msg("Expected no injected faults for '$name' profile, got $row->{faults}"));
+  }
+}
+
+# Fails if either idle profile's best throughput is more than the allowed
+# percentage below the baseline's.
+sub perf_check_overhead {
+  my $self = shift;
+  my $workload = shift;
+
+  my $results = perf_run_profiles($self, $workload, {
+    profiles => $OVERHEAD_PROFILES,
+    iterations => $PERF_OVERHEAD_ITERATIONS,
+    rounds => $PERF_OVERHEAD_ROUNDS,
+  });
+
+  my $baseline = $results->{baseline}->{throughput_bps};
+  $self->assert($baseline > 0,
+    test_msg("Expected non-zero baseline $workload throughput"));
+
+  foreach my $name ('idle-no-rules', 'idle-unrelated-rules') {
+    my $throughput = $results->{$name}->{throughput_bps};
+    my $overhead = (($baseline - $throughput) * 100) / $baseline;
+
+    if ($ENV{TEST_VERBOSE}) {
+      print STDERR "# $workload overhead for '$name': ",
+        sprintf('%.2f', $overhead), "%\n";
+    }
+
+    $self->assert($overhead <= $PERF_OVERHEAD_THRESHOLD,
+      test_msg(sprintf("Expected $workload overhead for '$name' of at most %s%%, got %.2f%% ($throughput vs $baseline bytes/sec)", $PERF_OVERHEAD_THRESHOLD, $overhead)));
+  }
+}
+
+# Test cases
+
+sub fault_perf_retr {
+  my $self = shift;
+
+  my $results = perf_run_profiles($self, 'RETR');
+  perf_check_results($self, 'RETR', $results);
+
+  # Allow some slack for the first read, which is not delayed.
+  my $throughput = $results->{'bandwidth-20MBps'}->{throughput_bps};
+  $self->assert($throughput <= (20 * 1024 * 1024 * 1.1),
+    test_msg("Expected RETR throughput capped at 20 MB/s, got $throughput bytes/sec"));
+
+  my $faults = $results->{'eio-1pct'}->{faults};
+  my $failures = $results->{'eio-1pct'}->{failures};
+  $self->assert($failures <= $faults,
+    test_msg("Expected at most $faults failed RETR commands, got $failures"));
+}
+
+sub fault_perf_retr_sendfile {
+  my $self = shift;
+
+  my $results = perf_run_profiles($self, 'RETR', { sendfile => 1 });
+  perf_check_results($self, 'RETR', $results);
+
+  # Make sure that the downloads were sent using sendfile, and thus were
+  # measured separately from those in fault_perf_retr.  Without any rules,
+  # mod_fault does not see the downloads at all.
+  foreach my $name (sort(keys(%$results))) {
+    next if $name eq 'clean';
+
+    my $io_path = $results->{$name}->{io_path};
+    $self->assert($io_path eq 'sendfile',
+      test_msg("Expected RETR using sendfile for '$name' profile, got $io_path"));
+  }
+
+  my $throughput = $results->{'bandwidth-20MBps'}->{throughput_bps};
+  $self->assert($throughput <= (20 * 1024 * 1024 * 1.1),
+    test_msg("Expected RETR throughput capped at 20 MB/s, got $throughput bytes/sec"));
+
+  # The data sent using sendfile(2) cannot be recalled, so an injected error
+  # must fail the RETR before the transfer starts.  With every read failing,
+  # every download must get an error response, rather than a 226.
+  $results = perf_run_profiles($self, 'RETR', {
+    sendfile => 1,
+    profiles => [
+      {
+        name => 'eio-all',
+        config => {
+          FaultEngine => 'on',
+          FaultInject => 'filesystem EIO read',
+        },
+      },
+    ],
+  });
+
+  my $row = $results->{'eio-all'};
+  $self->assert($row->{error_responses} == $row->{iterations},
+    test_msg("Expected $row->{iterations} RETR error responses, got $row->{error_responses}"));
+}
+
+sub fault_perf_stor {
+  my $self = shift;
+
+  my $results = perf_run_profiles($self, 'STOR');
+  perf_check_results($self, 'STOR', $results);
+
+  my $throughput = $results->{'bandwidth-20MBps'}->{throughput_bps};
+  $self->assert($throughput <= (20 * 1024 * 1024 * 1.1),
+    test_msg("Expected STOR throughput capped at 20 MB/s, got $throughput bytes/sec"));
+
+  # Every write is delayed, so each STOR takes at least 5ms.
+  my $latency = $results->{'write-latency-5ms'}->{avg_latency_ms};
+  $self->assert($latency >= 5,
+    test_msg("Expected STOR latency of at least 5ms, got ${latency}ms"));
+
+  my $faults = $results->{'eio-1pct'}->{faults};
+  my $failures = $results->{'eio-1pct'}->{failures};
+  $self->assert($failures <= $faults,
+    test_msg("Expected at most $faults failed STOR commands, got $failures"));
+}
+
+sub fault_perf_list {
+  my $self = shift;
+
+  my $results = perf_run_profiles($self, 'LIST');
+  perf_check_results($self, 'LIST', $results);
+}
+
+sub fault_perf_concurrency_ftp {
+  my $self = shift;
+
+  perf_run_sessions($self, 'FTP');
+}
+
+sub fault_perf_concurrency_sftp {
+  my $self = shift;
+
+  perf_run_sessions($self, 'SFTP');
+}
+
+sub fault_perf_overhead_retr {
+  my $self = shift;
+
+  perf_check_overhead($self, 'RETR');
+}
+
+sub fault_perf_overhead_stor {
+  my $self = shift;
+
+  perf_check_overhead($self, 'STOR');
+}
+
+sub fault_perf_overhead_list {
+  my $self = shift;
+
+  perf_check_overhead($self, 'LIST');
+}
+
+1;
@@ -62,6 +62,11 @@ if (scalar(@ARGV) > 0) {
   my $order = 0;
 
   my $FEATURE_TESTS = {
+    't/modules/mod_fault/perf.t' => {
+      order => ++$order,
+      test_class => [qw(mod_fault)],
+    },
+
     't/modules/mod_fault/sftp.t' => {
       order => ++$order,
       test_class => [qw(mod_fault mod_sftp)],